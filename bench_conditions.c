@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "y.tab.h"
+#include "symboltable.h"
+#include "condition.h"
+#include "state_registry.h"
+
+/* time check_all_conditions() on a synthetic configuration with many states.
+   Each state compares an integer, a string and a pattern, and one variable 
+   changes each cycle as it would in a typical deployment.
+ */
+
+#define NUM_STATES 1000
+#define NUM_LEVELS 50
+#define NUM_NAMES 20
+
+symbol_table states;
+
+int main(int argc, char *argv[])
+{
+	symbol_table variables = init_symbol_table();
+	int cycles = (argc > 1) ? atoi(argv[1]) : 2000;
+	int start_set, unknown_set;
+	int i;
+	int checksum = 0;
+	struct timespec begin, end;
+	double elapsed;
+
+	states = init_symbol_table();
+	init_conditions();
+	init_state_registry();
+	start_set = create_condition_set();
+	unknown_set = create_condition_set();
+	set_integer_value(states, "START", start_set);
+	set_integer_value(states, "UNKNOWN", unknown_set);
+	register_state(start_set, "START");
+	register_state(unknown_set, "UNKNOWN");
+	for (i=0; i<NUM_STATES; i++)
+	{
+		char name[40], level[40], value[40], host[40], pattern[40];
+		int set = create_condition_set();
+		sprintf(name, "STATE_%d", i);
+		sprintf(level, "LEVEL_%d", i % NUM_LEVELS);
+		sprintf(value, "%d", i / NUM_LEVELS);
+		sprintf(host, "HOST_%d", i % NUM_NAMES);
+		sprintf(pattern, "^host%d\\.", (i / NUM_NAMES) % NUM_NAMES);
+		set_integer_value(states, name, set);
+		register_state(set, name);
+		add_condition(set, level, GE, value, NULL);
+		add_condition(set, "MODE", EQ, (i % 2) ? "running" : "stopped", NULL);
+		add_condition(set, host, MATCHES, pattern, NULL);
+	}
+	for (i=0; i<NUM_LEVELS; i++)
+	{
+		char name[40];
+		sprintf(name, "LEVEL_%d", i);
+		set_integer_value(variables, name, i % 20);
+	}
+	for (i=0; i<NUM_NAMES; i++)
+	{
+		char name[40], value[40];
+		sprintf(name, "HOST_%d", i);
+		sprintf(value, "host%d.example.com", i);
+		set_string_value(variables, name, value);
+	}
+	set_string_value(variables, "MODE", "running");
+	bind_all_conditions(variables);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i=0; i<cycles; i++)
+	{
+		char name[40];
+		sprintf(name, "LEVEL_%d", i % NUM_LEVELS);
+		set_integer_value(variables, name, i % 20);
+		checksum += check_all_conditions(variables);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - begin.tv_sec) * 1e6 + (end.tv_nsec - begin.tv_nsec) / 1e3;
+	printf("%d states, %d cycles: %.1f us per cycle (checksum %d)\n", 
+			NUM_STATES, cycles, elapsed / cycles, checksum);
+
+	release_all_conditions();
+	free_symbol_table(variables);
+	free_symbol_table(states);
+	return 0;
+}
@@ -26,6 +26,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "y.tab.h"
 #include "symboltable.h"
@@ -35,6 +36,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "options.h"
 #include "property.h"
 #include "plugin.h"
+#include "state_registry.h"
+#include "numbers.h"
 
 /*
 condition_function socket_script;
@@ -43,63 +46,269 @@ condition_function read_file;
 
 /*
 
-Two optimisations would be nice for this module:
+Identical tests used by several states are shared: there is a single list 
+of distinct conditions and each condition records the condition sets that
+use it. Each condition is evaluated once per cycle and its result is given
+to all of its sets.
 
-   - reuse similar tests (ie a test will need to be shared by multiple states
-   - short circuit evaluation
-  
-Currently each condition has a single set and there is a single list of, 
-conditions. There are two obvious ways to change the program; have each 
-condition maintain a list of sets it is part of or build a list of 
-condition sets which link to shared condition items. Since many operations
-are based on condition sets, the latter seems appropriate.
+Evaluation is short circuited: a test is skipped once every set using it 
+has failed. To make that pay, the tests are reordered from time to time so
+that cheap tests that often fail run first. Assignments are always run, 
+and before the tests, since the tests may use the values they collect.
+Assignments that call plugins able to run in parallel are started together
+on worker threads at the start of a cycle, see collect_in_parallel().
+
+A test that only compares variables is re-evaluated only when the 
+generation of one of those variables has changed since it was last run.
+
+Matches that test the same input share the scan for the literal text their
+patterns require, so the patterns whose literal is absent are not run.
+
+Each instruction keeps a profile of how often it ran, how often it passed, 
+its latency and the data it collected, see display_condition_profile(). 
+Collections also publish theirs as STAT_<variable>_<statistic> variables.
+
+A collection may be given a refresh interval, in which case the value it 
+collected is kept until the interval has passed rather than collected again
+each cycle.
 
 */
 
 typedef struct condition
 {
 	struct condition *next;
-	int set;
+	int *sets; /* the condition sets using this test. A set may use a test more than once */
+	int num_sets;
+	int sets_size;
 	char *test;
 	int operation;
 	char *check;
 	rexp_info *rexp;
     parameter_list parameters;
+	int sequence; /* order in which the condition was added */
+	int refresh_interval; /* seconds between collections, 0 to collect every cycle */
 } condition;
 
+/* how an instruction of the compiled program is evaluated */
+enum opcode
+{
+	OP_ASSIGN, /* collect data from a variable or plugin into test_ref */
+	OP_COMPARE, /* compare data with the variable, or the string, at check_ref */
+	OP_COMPARE_INTEGER, /* compare data with the literal check_integer */
+	OP_MATCH, /* match data with the pattern of the condition */
+	OP_TIMER, /* compare the timer with check_integer or the variable at check_ref */
+	OP_FAIL /* a test that cannot pass, eg one with a bad pattern */
+};
+
+/* 
+   The conditions are compiled into a program, one instruction per condition,
+   held as parallel arrays so that a cycle walks a few contiguous arrays 
+   rather than the list. Operands are classified when the program is 
+   compiled: names are bound to symbols, literal integers are parsed and a
+   test data source is either a variable (test_ref) or a plugin call 
+   (NO_SYMBOL). The instructions run in the sequence given by order, with 
+   the assignments first.
+ */
+static struct program
+{
+	int length;
+	int num_assignments;
+	int *order; /* the instructions, in the sequence they are run */
+	condition **source; /* the condition each instruction was compiled from */
+	unsigned char *opcode;
+	int *operation;
+	symbol_ref *test_ref; /* the variable read or, for assignments, written */
+	symbol_ref *check_ref; /* the variable compared against or collected from */
+	int *check_integer;
+	int *first_set; /* the sets using the result of an instruction are in set_list */
+	int *num_sets;
+	int *set_list;
+	/* the result of a test that only compares variables is kept until they change */
+	unsigned char *pure; /* the test depends only on test_ref and check_ref */
+	unsigned char *memo_valid; /* last_result is valid for the generations below */
+	unsigned char *last_result;
+	unsigned int *test_generation;
+	unsigned int *check_generation;
+	/* measurements used to order the tests */
+	long *cost; /* moving average of the time taken by the test, in nanoseconds */
+	int *failure_rate; /* moving average of failures, 0..FAILURE_SCALE */
+	/* collections with a refresh interval, see schedule_refresh() */
+	int *refresh_interval;
+	unsigned char *fresh; /* the collected value is still current, do not collect it */
+	long *due; /* when a fresh value becomes stale */
+	int *next_timer; /* the next instruction in the same slot of the timer wheel */
+	/* matches, see group_matches() */
+	int *match_group;
+	int *literal; /* the literal required by the pattern, in the literal set of the group */
+	/* working space for collect_in_parallel() */
+	plugin_call **calls;
+	int *call_instruction; /* the instruction each call was started for */
+	char **call_keys; /* buffers for the keys of the calls, kept between cycles */
+	int *call_key_sizes;
+	/* profile, see record_latency() */
+	long *call_ns; /* latency of this cycle's parallel call for the instruction, -1 if none */
+	unsigned long *runs;
+	unsigned long *passes;
+	unsigned long *timed_runs;
+	double *total_ns;
+	long *min_ns;
+	long *max_ns;
+	unsigned long *latency_histogram; /* LATENCY_BUCKETS counts for each instruction */
+	double *bytes_collected;
+	symbol_ref *stat_refs; /* NUM_STATS for each instruction, see bind_statistics() */
+} program;
+
+/* 
+   Plugins and commands are timed every time they run, parallel calls from 
+   when the calls are started until they finish. Tests that only read 
+   variables are cheaper than reading the clock and are timed on measuring 
+   cycles. Latencies are counted in buckets of powers of two nanoseconds for 
+   the percentile.
+ */
+#define LATENCY_BUCKETS 40
+
+enum { STAT_RUNS, STAT_PASS_RATE, STAT_AVG_US, STAT_MIN_US, STAT_MAX_US, STAT_P99_US, STAT_BYTES, NUM_STATS };
+static const char *stat_names[NUM_STATS] = { "RUNS", "PASS_RATE", "AVG_US", "MIN_US", "MAX_US", "P99_US", "BYTES" };
+
+#define NO_GROUP -1
+
+static struct match_group
+{
+	const char *input; /* the test of the conditions in the group */
+	literal_set *literals;
+	shared_value scanned; /* the value last scanned for the literals */
+	unsigned char *found;
+} *match_groups;
+static int num_match_groups;
+
+/* 
+   Collections with a refresh interval are kept on a timer wheel with a slot
+   for each second. A fresh collection sits in the slot of the second it is 
+   due, and advancing the wheel to the current time marks the collections in 
+   the slots passed over as stale. Intervals longer than the wheel simply wait
+   for the wheel to come round again.
+ */
+#define WHEEL_SLOTS 64
+#define NO_TIMER -1
+
+static int wheel[WHEEL_SLOTS];
+static long wheel_time; /* the second the wheel has been advanced to */
+
+static int program_stale = 1; /* the conditions have changed since the program was compiled */
+
+#define FAILURE_SCALE 1024
+#define AVERAGING_WEIGHT 8 /* new measurements count for 1/8 of the average */
+#define REORDER_INTERVAL 32 /* cycles between reordering the tests */
+#define MEASUREMENT_INTERVAL 8 /* cycles between timing the tests, reading the clock is not free */
+
 condition *condition_table = NULL;
 static int num_entries;
+static int next_sequence;
+static int cycles_since_reorder;
 
 static int condition_set_number;
 
+/* working space of check_all_conditions(), an entry for each condition set */
+static int *failed;
+static int *conditions_run;
+static int condition_set_space;
+
+/* time spent by the last plugin or command run for a test, -1 if there was none */
+static long last_collection_ns = -1;
+
 /* a condition set does not need to be in a 'states' symbol table
     it is convenient, however, to use the fact it is to make our
     verbose reporting a little easier to comprehend 
 */
 extern symbol_table states;
 
+/* references to the variables that conditions use implicitly */
+static symbol_ref result_ref = NO_SYMBOL;
+static symbol_ref result_status_ref = NO_SYMBOL;
+static symbol_ref start_state_ref = NO_SYMBOL;
+static symbol_ref unknown_state_ref = NO_SYMBOL;
+static symbol_ref cycle_time_ref = NO_SYMBOL;
+
+static long elapsed_ns(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+/* plugin results collected during the current cycle, so that a command 
+   used by several tests is only run once per cycle. Commands are compared
+   with their white space normalised. The entries keep their command 
+   buffers when the cache is cleared so that they can be reused.
+ */
+struct cached_result
+{
+	char *command;
+	int command_size;
+	shared_value value; /* RESULT as the plugin left it */
+	int status; /* RESULT_STATUS */
+};
+
+static struct cached_result *result_cache = NULL;
+static int num_cached_results = 0;
+static int result_cache_size = 0;
+static char *command_key = NULL; /* reused to build the key of each command */
+static int command_key_size = 0;
+
+static void clear_result_cache();
+static void free_program();
+
 void init_conditions()
 {
 	condition_set_number = 0;
 	condition_table = NULL;
+	program_stale = 1;
 	num_entries = 0;
+	next_sequence = 0;
+	cycles_since_reorder = 0;
+	result_ref = NO_SYMBOL;
+	result_status_ref = NO_SYMBOL;
+	start_state_ref = NO_SYMBOL;
+	unknown_state_ref = NO_SYMBOL;
+}
+
+static void free_condition(condition *c)
+{
+	free(c->test);
+	free(c->check);
+	if (c->rexp != NULL)
+		release_pattern(c->rexp);
+	if (c->parameters)
+		free_parameter_list(c->parameters);
+	free(c->sets);
+	free(c);
 }
 
 void release_all_conditions()
 {
 	condition *curr = condition_table;
+	int i;
 	while (curr != NULL) 
 	{
 		condition_table = condition_table->next;
-		free(curr->test);
-		free(curr->check);
-		if (curr->rexp != NULL)
-			release_pattern(curr->rexp);
-        if (curr->parameters)
-            free_parameter_list(curr->parameters);
-		free(curr);
+		free_condition(curr);
 		curr = condition_table;
 	}
+	clear_result_cache();
+	for (i=0; i<result_cache_size; i++)
+		free(result_cache[i].command);
+	free(result_cache);
+	result_cache = NULL;
+	result_cache_size = 0;
+	free(command_key);
+	command_key = NULL;
+	command_key_size = 0;
+	free_program();
+	free(failed);
+	free(conditions_run);
+	failed = NULL;
+	conditions_run = NULL;
+	condition_set_space = 0;
 	init_conditions();
 }
 
@@ -130,10 +339,13 @@ void display_all_conditions()
 	while (curr != NULL) 
 	{
         const char *op = op_name(curr->operation);
+		int i;
+		for (i=0; i<curr->num_sets; i++)
+			printf("%s%d", (i) ? "," : "", curr->sets[i]);
         if (op && *op)
-		   printf("%d: %s %s", curr->set, curr->test, op);
+		   printf(": %s %s", curr->test, op);
         else
-		   printf("%d: %s %d", curr->set, curr->test, curr->operation);
+		   printf(": %s %d", curr->test, curr->operation);
 		if (curr->rexp && (curr->operation == MATCHES || curr->operation == NOT_MATCHES) ) 
 		{
 			printf(" pattern: %s is %scompiled\n", curr->rexp->pattern, (curr->rexp->compilation_result != 0) ? "not" : "");
@@ -151,14 +363,73 @@ int create_condition_set()
 	return result;
 }
 
+static void add_condition_set(condition *c, int set)
+{
+	if (c->num_sets == c->sets_size)
+	{
+		c->sets_size = (c->sets_size) ? c->sets_size * 2 : 4;
+		c->sets = realloc(c->sets, c->sets_size * sizeof(int));
+	}
+	c->sets[c->num_sets++] = set;
+}
+
+static int same_parameters(parameter_list a, parameter_list b)
+{
+	int i;
+	if (a == NULL || b == NULL)
+		return a == b;
+	if (a->used != b->used)
+		return 0;
+	for (i=0; i<a->used; i++)
+		if (strcmp(a->elements[i], b->elements[i]) != 0)
+			return 0;
+	return 1;
+}
+
+/* an existing condition making the same test, or NULL */
+static condition *find_condition(const char *test, int op, const char *check, parameter_list params)
+{
+	condition *curr = condition_table;
+	if (check == NULL)
+		check = "";
+	while (curr != NULL)
+	{
+		if (curr->operation == op && strcmp(curr->test, test) == 0
+				&& strcmp(curr->check, check) == 0 && same_parameters(curr->parameters, params))
+			return curr;
+		curr = curr->next;
+	}
+	return NULL;
+}
+
 void add_condition(int set, const char *test, int op, const char *check, parameter_list params)
+{
+	add_periodic_condition(set, test, op, check, params, 0);
+}
+
+void add_periodic_condition(int set, const char *test, int op, const char *check, 
+		parameter_list params, int refresh_interval)
 {
 	/*
 	 Conditions can be tested in any order except that conditions 
 	 which collect data into symbols must be evaluated first. 
 	 We push those to the head of the condition list.
 	*/
-	condition *new_condition = malloc(sizeof(struct condition));
+	condition *new_condition = find_condition(test, op, check, params);
+	if (new_condition)
+	{
+		/* the test is already made for another state, as often as the most demanding state needs */
+		add_condition_set(new_condition, set);
+		if (refresh_interval == 0 || new_condition->refresh_interval == 0)
+			new_condition->refresh_interval = 0;
+		else if (refresh_interval < new_condition->refresh_interval)
+			new_condition->refresh_interval = refresh_interval;
+		if (params)
+			free_parameter_list(params);
+		program_stale = 1;
+		return;
+	}
+	new_condition = malloc(sizeof(struct condition));
 	if (op == ASSIGNED)
 	{
 		new_condition->next = condition_table;
@@ -179,7 +450,12 @@ void add_condition(int set, const char *test, int op, const char *check, paramet
 			condition_table = new_condition;
 		new_condition->next = NULL;
 	}
-	new_condition->set = set;
+	new_condition->sets = NULL;
+	new_condition->num_sets = 0;
+	new_condition->sets_size = 0;
+	add_condition_set(new_condition, set);
+	new_condition->sequence = next_sequence++;
+	new_condition->refresh_interval = (refresh_interval > 0) ? refresh_interval : 0;
 	new_condition->test = strdup(test);
 	new_condition->operation = op;
     new_condition->parameters = params;
@@ -195,6 +471,284 @@ void add_condition(int set, const char *test, int op, const char *check, paramet
 		new_condition->rexp = NULL;
 	}
 	num_entries++;
+	program_stale = 1;
+}
+
+int is_comparison_op(int op);
+
+/* bind the name of a variable that collect_data() may read. Plugin calls 
+   are not variables so are left for collect_data() to run.
+ */
+static symbol_ref bind_data_source(symbol_table variables, const char *command_string)
+{
+    const char *start_p = command_string;
+    while (start_p && *start_p && isspace(*start_p)) start_p++;
+    if (!start_p || strncmp(start_p, "CALL ", 5) == 0)
+        return NO_SYMBOL;
+    return bind_symbol(variables, start_p);
+}
+
+static long monotonic_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+static void *program_array(int count, size_t size)
+{
+	return malloc(((count) ? count : 1) * size);
+}
+
+static void free_program()
+{
+	int i;
+	free(program.order);
+	free(program.source);
+	free(program.opcode);
+	free(program.operation);
+	free(program.test_ref);
+	free(program.check_ref);
+	free(program.check_integer);
+	free(program.first_set);
+	free(program.num_sets);
+	free(program.set_list);
+	free(program.pure);
+	free(program.memo_valid);
+	free(program.last_result);
+	free(program.test_generation);
+	free(program.check_generation);
+	free(program.cost);
+	free(program.failure_rate);
+	free(program.refresh_interval);
+	free(program.fresh);
+	free(program.due);
+	free(program.next_timer);
+	free(program.match_group);
+	free(program.literal);
+	free(program.calls);
+	free(program.call_instruction);
+	for (i=0; i<program.length; i++)
+		free(program.call_keys[i]);
+	free(program.call_keys);
+	free(program.call_key_sizes);
+	free(program.call_ns);
+	free(program.runs);
+	free(program.passes);
+	free(program.timed_runs);
+	free(program.total_ns);
+	free(program.min_ns);
+	free(program.max_ns);
+	free(program.latency_histogram);
+	free(program.bytes_collected);
+	free(program.stat_refs);
+	for (i=0; i<num_match_groups; i++)
+	{
+		release_literal_set(match_groups[i].literals);
+		release_shared_value(match_groups[i].scanned);
+		free(match_groups[i].found);
+	}
+	free(match_groups);
+	match_groups = NULL;
+	num_match_groups = 0;
+	memset(&program, 0, sizeof(program));
+	program_stale = 1;
+}
+
+/* the statistics of instruction i are published as STAT_<name>_<statistic> */
+static void bind_statistics(symbol_table variables, int i, const char *name)
+{
+	char stat_name[250];
+	int n;
+	for (n=0; n<NUM_STATS; n++)
+	{
+		snprintf(stat_name, sizeof(stat_name), "STAT_%s_%s", name, stat_names[n]);
+		program.stat_refs[i * NUM_STATS + n] = bind_symbol(variables, stat_name);
+	}
+}
+
+/* compile a condition into instruction i, resolving the names it uses to 
+   symbol references so that running it does not search the symbol table.
+ */
+static void compile_condition(symbol_table variables, condition *c, int i)
+{
+	char name[200];
+	int n;
+	program.source[i] = c;
+	program.order[i] = i;
+	program.operation[i] = c->operation;
+	program.test_ref[i] = NO_SYMBOL;
+	program.check_ref[i] = NO_SYMBOL;
+	program.check_integer[i] = 0;
+	program.memo_valid[i] = 0;
+	program.cost[i] = 0;
+	program.failure_rate[i] = FAILURE_SCALE / 2;
+	program.refresh_interval[i] = c->refresh_interval;
+	program.fresh[i] = 0;
+	program.due[i] = 0;
+	program.next_timer[i] = NO_TIMER;
+	program.runs[i] = 0;
+	program.passes[i] = 0;
+	program.timed_runs[i] = 0;
+	program.total_ns[i] = 0;
+	program.min_ns[i] = 0;
+	program.max_ns[i] = 0;
+	memset(program.latency_histogram + i * LATENCY_BUCKETS, 0, LATENCY_BUCKETS * sizeof(unsigned long));
+	program.bytes_collected[i] = 0;
+	program.call_ns[i] = -1;
+	if (c->operation == ASSIGNED)
+	{
+		program.opcode[i] = OP_ASSIGN;
+		program.test_ref[i] = bind_symbol(variables, c->test);
+		program.check_ref[i] = bind_data_source(variables, c->check);
+		program.pure[i] = 0;
+		bind_statistics(variables, i, c->test);
+		return;
+	}
+	snprintf(name, sizeof(name), "CONDITION_%d", c->sequence);
+	bind_statistics(variables, i, name);
+	program.test_ref[i] = bind_data_source(variables, c->test);
+	if ( (c->operation == MATCHES || c->operation == NOT_MATCHES) && c->rexp)
+		program.opcode[i] = (c->rexp->compilation_result == 0) ? OP_MATCH : OP_FAIL;
+	else if (strcmp(c->test, "TIMER") == 0)
+	{
+		program.opcode[i] = OP_TIMER;
+		if (parse_integer(c->check, &n))
+			program.check_integer[i] = n;
+		else
+			program.check_ref[i] = bind_symbol(variables, c->check);
+	}
+	else if (is_comparison_op(c->operation))
+	{
+		if (parse_integer(c->check, &n))
+		{
+			program.opcode[i] = OP_COMPARE_INTEGER;
+			program.check_integer[i] = n;
+		}
+		else
+		{
+			program.opcode[i] = OP_COMPARE;
+			program.check_ref[i] = bind_symbol(variables, c->check);
+		}
+	}
+	else
+		program.opcode[i] = OP_FAIL;
+	program.pure[i] = program.test_ref[i] != NO_SYMBOL
+		&& (program.opcode[i] == OP_COMPARE || program.opcode[i] == OP_COMPARE_INTEGER 
+			|| program.opcode[i] == OP_MATCH);
+}
+
+/* 
+   Matches on the same input are grouped and the literals their patterns 
+   require are collected into a set for the group, see execute_match().
+ */
+static void group_matches()
+{
+	int i;
+	int g;
+	match_groups = program_array(program.length, sizeof(struct match_group));
+	num_match_groups = 0;
+	for (i=0; i<program.length; i++)
+	{
+		condition *c = program.source[i];
+		program.match_group[i] = NO_GROUP;
+		program.literal[i] = NO_GROUP;
+		if (program.opcode[i] != OP_MATCH || c->rexp->literal == NULL)
+			continue;
+		for (g=0; g<num_match_groups; g++)
+			if (strcmp(match_groups[g].input, c->test) == 0)
+				break;
+		if (g == num_match_groups)
+		{
+			match_groups[g].input = c->test;
+			match_groups[g].literals = create_literal_set();
+			match_groups[g].scanned = NULL;
+			num_match_groups++;
+		}
+		program.match_group[i] = g;
+		program.literal[i] = add_literal(match_groups[g].literals, c->rexp->literal);
+	}
+	for (g=0; g<num_match_groups; g++)
+		match_groups[g].found = malloc(literal_set_size(match_groups[g].literals));
+}
+
+static void compile_conditions(symbol_table variables)
+{
+	condition *curr;
+	int count = 0;
+	int num_set_entries = 0;
+	int i;
+	free_program();
+	for (curr = condition_table; curr != NULL; curr = curr->next)
+	{
+		count++;
+		num_set_entries += curr->num_sets;
+	}
+	program.order = program_array(count, sizeof(int));
+	program.source = program_array(count, sizeof(condition *));
+	program.opcode = program_array(count, sizeof(unsigned char));
+	program.operation = program_array(count, sizeof(int));
+	program.test_ref = program_array(count, sizeof(symbol_ref));
+	program.check_ref = program_array(count, sizeof(symbol_ref));
+	program.check_integer = program_array(count, sizeof(int));
+	program.first_set = program_array(count, sizeof(int));
+	program.num_sets = program_array(count, sizeof(int));
+	program.set_list = program_array(num_set_entries, sizeof(int));
+	program.pure = program_array(count, sizeof(unsigned char));
+	program.memo_valid = program_array(count, sizeof(unsigned char));
+	program.last_result = program_array(count, sizeof(unsigned char));
+	program.test_generation = program_array(count, sizeof(unsigned int));
+	program.check_generation = program_array(count, sizeof(unsigned int));
+	program.cost = program_array(count, sizeof(long));
+	program.failure_rate = program_array(count, sizeof(int));
+	program.refresh_interval = program_array(count, sizeof(int));
+	program.fresh = program_array(count, sizeof(unsigned char));
+	program.due = program_array(count, sizeof(long));
+	program.next_timer = program_array(count, sizeof(int));
+	program.match_group = program_array(count, sizeof(int));
+	program.literal = program_array(count, sizeof(int));
+	program.calls = program_array(count, sizeof(plugin_call *));
+	program.call_instruction = program_array(count, sizeof(int));
+	program.call_keys = calloc((count) ? count : 1, sizeof(char *));
+	program.call_key_sizes = calloc((count) ? count : 1, sizeof(int));
+	program.call_ns = program_array(count, sizeof(long));
+	program.runs = program_array(count, sizeof(unsigned long));
+	program.passes = program_array(count, sizeof(unsigned long));
+	program.timed_runs = program_array(count, sizeof(unsigned long));
+	program.total_ns = program_array(count, sizeof(double));
+	program.min_ns = program_array(count, sizeof(long));
+	program.max_ns = program_array(count, sizeof(long));
+	program.latency_histogram = program_array(count * LATENCY_BUCKETS, sizeof(unsigned long));
+	program.bytes_collected = program_array(count, sizeof(double));
+	program.stat_refs = program_array(count * NUM_STATS, sizeof(symbol_ref));
+	for (i=0; i<WHEEL_SLOTS; i++)
+		wheel[i] = NO_TIMER;
+	wheel_time = monotonic_seconds();
+	num_set_entries = 0;
+	for (i = 0, curr = condition_table; curr != NULL; i++, curr = curr->next)
+	{
+		compile_condition(variables, curr, i);
+		if (curr->operation == ASSIGNED)
+			program.num_assignments = i + 1;
+		program.first_set[i] = num_set_entries;
+		program.num_sets[i] = curr->num_sets;
+		memcpy(program.set_list + num_set_entries, curr->sets, curr->num_sets * sizeof(int));
+		num_set_entries += curr->num_sets;
+	}
+	program.length = count;
+	group_matches();
+	cycles_since_reorder = 0;
+	program_stale = 0;
+}
+
+void bind_all_conditions(symbol_table variables)
+{
+	result_ref = bind_symbol(variables, "RESULT");
+	result_status_ref = bind_symbol(variables, "RESULT_STATUS");
+	start_state_ref = bind_symbol(states, "START");
+	unknown_state_ref = bind_symbol(states, "UNKNOWN");
+	cycle_time_ref = bind_symbol(variables, "STAT_CYCLE_US");
+	compile_conditions(variables);
 }
 
 long integer_value(symbol_table variables, const char *str)
@@ -266,9 +820,160 @@ int perform_string_compare(const char *s1, int op, const char * s2)
 	return perform_integer_compare(res, op, 0);
 }
 
-static char * collect_data(symbol_table variables, const char *command_string)
+static void clear_result_cache()
+{
+	int i;
+	for (i=0; i<num_cached_results; i++)
+		release_shared_value(result_cache[i].value);
+	num_cached_results = 0;
+}
+
+/* make sure a buffer kept for reuse can hold len characters */
+static char *reserve_buffer(char **buf, int *size, int len)
+{
+	if (len + 1 > *size)
+	{
+		*size = len + 1;
+		*buf = realloc(*buf, *size);
+	}
+	return *buf;
+}
+
+/* the key of a command in the result cache: the command with runs of white 
+   space between its parameters replaced by a single space. Quoted text is 
+   kept as it is, since split_string() passes it to the plugin unchanged.
+ */
+static char *normalise_command(const char *command, char **buf, int *size)
+{
+	char *result = reserve_buffer(buf, size, strlen(command));
+	char *out = result;
+	const char *p = command;
+	while (*p)
+	{
+		while (*p && isspace(*p)) p++;
+		if (!*p) break;
+		if (out != result) *out++ = ' ';
+		while (*p && !isspace(*p))
+		{
+			char quote = *p;
+			*out++ = *p++;
+			if (quote != '"' && quote != '\'')
+				continue;
+			while (*p && *p != quote)
+				*out++ = *p++;
+			if (*p)
+				*out++ = *p++;
+		}
+	}
+	*out = 0;
+	return result;
+}
+
+static int find_cached_result(const char *key)
+{
+	int i;
+	for (i=0; i<num_cached_results; i++)
+		if (strcmp(result_cache[i].command, key) == 0)
+			return i;
+	return -1;
+}
+
+/* keep the result of a command for the rest of the cycle. The cache copies
+   the key and takes over the reference to the value.
+ */
+static void remember_result(const char *key, shared_value value, int status)
 {
-	char *buf = NULL;
+	struct cached_result *entry;
+	if (num_cached_results == result_cache_size)
+	{
+		int old_size = result_cache_size;
+		result_cache_size = (result_cache_size) ? result_cache_size * 2 : 8;
+		result_cache = realloc(result_cache, result_cache_size * sizeof(struct cached_result));
+		memset(result_cache + old_size, 0, (result_cache_size - old_size) * sizeof(struct cached_result));
+	}
+	entry = &result_cache[num_cached_results];
+	strcpy(reserve_buffer(&entry->command, &entry->command_size, strlen(key)), key);
+	entry->value = value;
+	entry->status = status;
+	num_cached_results++;
+}
+
+/* run a plugin, or reuse its result from earlier in this cycle. The result
+   is left in RESULT and RESULT_STATUS as if the plugin had been run.
+ */
+static int run_plugin(symbol_table variables, const char *command, shared_value *result)
+{
+	char *key = normalise_command(command, &command_key, &command_key_size);
+	int plugin_result;
+	int i = find_cached_result(key);
+	*result = NULL;
+	if (i >= 0)
+	{
+		if (result_cache[i].value)
+			set_ref_shared_value(variables, result_ref, result_cache[i].value);
+		set_ref_integer_value(variables, result_status_ref, result_cache[i].status);
+		if (result_cache[i].status == PLUGIN_COMPLETED)
+			*result = retain_shared_value(result_cache[i].value);
+		return result_cache[i].status;
+	}
+	plugin_result = plugin(variables, command, NULL);
+	set_ref_integer_value(variables, result_status_ref, plugin_result);
+	if (plugin_result == PLUGIN_COMPLETED)
+		*result = get_ref_shared_value(variables, result_ref);
+	if (plugin_result != NO_PLUGIN_AVAILABLE && plugin_results_cacheable(variables, key))
+		remember_result(key, get_ref_shared_value(variables, result_ref), plugin_result);
+	return plugin_result;
+}
+
+/* start the plugin calls of the assignments on worker threads and wait for
+   them together, so that collecting takes about as long as the slowest call
+   rather than the sum of them. Only plugins with PARALLEL set are run this
+   way; their results are left in the result cache for the assignments.
+ */
+static void collect_in_parallel(symbol_table variables)
+{
+	plugin_call **calls = program.calls;
+	char **keys = program.call_keys;
+	int num_calls = 0;
+	struct timespec start;
+	int k;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (k=0; k<program.num_assignments; k++)
+	{
+		int i = program.order[k];
+		const char *command = program.source[i]->check;
+		plugin_call *call = NULL;
+		char *key;
+		int j;
+		if (program.check_ref[i] != NO_SYMBOL || program.fresh[i])
+			continue; /* collected from a variable, or not due yet */
+		while (isspace(*command)) command++;
+		command += 5; /* skip CALL */
+		key = normalise_command(command, &keys[num_calls], &program.call_key_sizes[num_calls]);
+		for (j=0; j<num_calls && strcmp(keys[j], key) != 0; j++)
+			;
+		if (j == num_calls && find_cached_result(key) < 0 && plugin_results_cacheable(variables, key))
+			call = start_plugin_call(variables, command);
+		if (!call)
+			continue;
+		program.call_instruction[num_calls] = i;
+		calls[num_calls++] = call;
+	}
+	for (k=0; k<num_calls; k++)
+	{
+		int status = finish_plugin_call(calls[k]);
+		program.call_ns[program.call_instruction[k]] = elapsed_ns(&start);
+		remember_result(keys[k], get_ref_shared_value(variables, result_ref), status);
+	}
+}
+
+/* collect data for a test. If the caller has already resolved the variable 
+   that may hold the data, ref is its reference, otherwise NO_SYMBOL.
+   The result is shared with the variable or plugin result it came from.
+ */
+static shared_value collect_data(symbol_table variables, const char *command_string, symbol_ref ref)
+{
+	shared_value buf = NULL;
     const char *start_p = command_string;
     while (start_p && *start_p && isspace(*start_p)) start_p++;
 #if 0
@@ -326,37 +1031,23 @@ static char * collect_data(symbol_table variables, const char *command_string)
     if (strncmp(start_p, "CALL ", 5) == 0)
     {
         const char *command = start_p+5;
-        int plugin_result = plugin(variables, command, NULL);
-        set_integer_value(variables, "RESULT_STATUS", plugin_result);
-        if (plugin_result == PLUGIN_COMPLETED)
-        {
-            const char *data = get_string_value(variables, "RESULT");
-            if (data != NULL)
-                buf = strdup(data);
- 			/* Note: null data from an explicit plugin call is a failure condition */
-        }
+        run_plugin(variables, command, &buf);
+        /* Note: null data from an explicit plugin call is a failure condition */
     }
     else
     {
-        const char *data = get_string_value(variables, start_p);
-        if (data != NULL)
-            buf = strdup(data);
-        else
+        buf = (ref != NO_SYMBOL) 
+            ? get_ref_shared_value(variables, ref)
+            : get_shared_value(variables, start_p);
+        if (buf == NULL)
         {
             int plugin_result;
             /* no variable with this name, try running a command */
-            plugin_result = plugin(variables, start_p, NULL);
-            set_integer_value(variables, "RESULT_STATUS", plugin_result);
-            if ( plugin_result == PLUGIN_COMPLETED)
-            {
-                const char *data = get_string_value(variables, "RESULT");
-                if (data != NULL)
-                    buf = strdup(data);
-            }
-            else if (plugin_result == NO_PLUGIN_AVAILABLE)
+            plugin_result = run_plugin(variables, start_p, &buf);
+            if (plugin_result == NO_PLUGIN_AVAILABLE)
             {
                 /* there is no plugin, use the string value for the lhs */
-                buf = strdup(command_string);
+                buf = new_shared_value(command_string);
             }
         }
 #if 0
@@ -371,101 +1062,199 @@ static char * collect_data(symbol_table variables, const char *command_string)
     return buf;	
 }
 
+/* collect_data() for a collection that runs a plugin or command, recording 
+   how long it took in last_collection_ns
+ */
+static shared_value timed_collect(symbol_table variables, const char *command_string, symbol_ref ref)
+{
+	struct timespec start;
+	shared_value result;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	result = collect_data(variables, command_string, ref);
+	last_collection_ns = elapsed_ns(&start);
+	return result;
+}
+
 static void display_condition(condition *curr)
 {
     const char *op = op_name(curr->operation);
-    const char *state_name = find_symbol_with_int_value(states, curr->set);
+    int i;
     if (op && *op)
-        printf("test: %s %s %s from state %s. ", curr->test, 
-            op, curr->check, state_name);
+        printf("test: %s %s %s from state", curr->test, 
+            op, curr->check);
     else
-        printf("test: %s %d %s from state %s. ", curr->test, 
-            curr->operation, curr->check, state_name);
+        printf("test: %s %d %s from state", curr->test, 
+            curr->operation, curr->check);
+    for (i=0; i<curr->num_sets; i++)
+        printf("%s %s", (i) ? "," : "", state_name(curr->sets[i]));
+    printf(". ");
 }
 
-static int check_one_condition(symbol_table variables, condition *curr)
+/* 
+   run the pattern of instruction i on the input, unless the literal it requires
+   is missing. The input is scanned for the literals of every pattern in the group
+   the first time it is seen and the result is reused by the others.
+ */
+static int execute_match(int i, shared_value input, const char *buf)
 {
-	char *buf = NULL;
-	int result = 1;  /* set this to zero if the check passes */
-	/* run this test */
-	if (verbose() || action_tracing()) 
-        display_condition(curr);
-
-    
-    /* phase 1. execute the actual test. Most of these are in external routines 
-          with an interface a bit like main()
-	 */
+	int g = program.match_group[i];
+	if (g != NO_GROUP)
+	{
+		struct match_group *group = &match_groups[g];
+		if (input == NULL || input != group->scanned)
+		{
+			release_shared_value(group->scanned);
+			group->scanned = retain_shared_value(input);
+			find_literals(group->literals, buf, group->found);
+		}
+		if (!group->found[program.literal[i]])
+			return REG_NOMATCH;
+		return confirm_pattern(program.source[i]->rexp, buf);
+	}
+	return execute_pattern(program.source[i]->rexp, buf);
+}
 
-	if (curr->operation == ASSIGNED /*&& curr->rexp*/)
+/* the result of a pattern match, 0 if the test passes */
+static int match_result(condition *curr, int res)
+{
+	if (res == 0)
 	{
-		/* in this case, the command to execute is the RHS of our condition. */
-		buf = collect_data(variables, curr->check);
-		if (buf)
+		if (curr->operation == NOT_MATCHES)
 		{
-			set_string_value(variables, curr->test, buf);
-			free(buf);
-            if (verbose() || action_tracing()) printf("\n");
-			return 0; /* gotcha: 0 means success! */
+			if (verbose() || action_tracing()) printf("test does not match\n");
+			return 1;
 		}
-		else
-			return result;
+		if (verbose() || action_tracing()) printf("test matches\n");
+		return 0;
 	}
-	else
+	else if (res == REG_NOMATCH)
 	{
-		/* try to collect data using a variable or by running a plugin. */
-		buf = collect_data(variables, curr->test);
-		if (buf == NULL) buf = strdup(""); 
+		if (curr->operation == NOT_MATCHES)
+		{
+			if (verbose() || action_tracing()) printf("test matches\n");
+			return 0;
+		}
+		if (verbose() || action_tracing()) printf("test does not match\n");
+		return 1;
 	}
-	
-	/* perform the test. Note that some tests do not need a buffer
-	   they are tested directly below */
-	if ( (curr->operation == MATCHES || curr->operation == NOT_MATCHES)  && curr->rexp)
+	printf("error %d running the test\n", res);
+	return 1;
+}
+
+/* the value collected by instruction i stays fresh for the given number of seconds */
+static void schedule_refresh(int i, int seconds)
+{
+	int slot;
+	program.due[i] = wheel_time + seconds;
+	slot = program.due[i] % WHEEL_SLOTS;
+	program.next_timer[i] = wheel[slot];
+	wheel[slot] = i;
+	program.fresh[i] = 1;
+}
+
+/* advance the wheel to the given time, marking the collections that are due as stale */
+static void advance_wheel(long now)
+{
+	long t = wheel_time + 1;
+	if (now - wheel_time >= WHEEL_SLOTS)
+		t = now - WHEEL_SLOTS + 1; /* visit each slot once */
+	for (; t <= now; t++)
 	{
-	
-		 if ( curr->rexp->compilation_result == 0)
+		int *link = &wheel[t % WHEEL_SLOTS];
+		while (*link != NO_TIMER)
+		{
+			int i = *link;
+			if (program.due[i] <= now)
 			{
-				int res;
-				if (buf == NULL)
-				 	res = execute_pattern(curr->rexp, curr->test);
-				else
-				 	res = execute_pattern(curr->rexp, buf);
-				
-                if (res == 0)
-                {
-                    if (curr->operation == NOT_MATCHES)
-                    {
-                        if (verbose() || action_tracing()) printf("test does not match\n");
-                    }
-					else 
-                    {
-                        if (verbose() || action_tracing()) printf("test matches\n");
-                        result = 0;
-                    }
-                }
-				else if (res == REG_NOMATCH)
-				{
-                    if (curr->operation == NOT_MATCHES)
-                    {
-                        if (verbose() || action_tracing()) printf("test matches\n");
-                        result = 0;
-                    }
-					else
-                    {
-                        if (verbose() || action_tracing()) printf("test does not match\n");
-                    }
-				}
-				else 
-					printf("error %d running the test\n", res);
+				*link = program.next_timer[i];
+				program.next_timer[i] = NO_TIMER;
+				program.fresh[i] = 0;
+			}
+			else
+				link = &program.next_timer[i];
+		}
+	}
+	if (now > wheel_time)
+		wheel_time = now;
+}
+
+void keep_collected_value(symbol_ref ref)
+{
+	int i;
+	for (i=0; i<program.length; i++)
+		if (program.opcode[i] == OP_ASSIGN && program.test_ref[i] == ref && !program.fresh[i])
+			schedule_refresh(i, (program.refresh_interval[i] > 0) ? program.refresh_interval[i] : 1);
+}
 
+/* run instruction i of the program, returning 0 if the test passes */
+static int run_instruction(symbol_table variables, int i)
+{
+	condition *curr = program.source[i];
+	int op = program.operation[i];
+	shared_value collected = NULL;
+	const char *buf = NULL;
+	char value_buf[SYMBOL_BUFFER_SIZE];
+	int result = 1;  /* set this to zero if the check passes */
+	unsigned int test_generation = 0;
+	unsigned int check_generation = 0;
+	if (program.pure[i])
+	{
+		test_generation = ref_generation(variables, program.test_ref[i]);
+		if (program.check_ref[i] != NO_SYMBOL)
+			check_generation = ref_generation(variables, program.check_ref[i]);
+		if (program.memo_valid[i] && test_generation == program.test_generation[i] 
+				&& check_generation == program.check_generation[i])
+		{
+			if (verbose() || action_tracing())
+			{
+				display_condition(curr);
+				printf("unchanged, %s\n", (program.last_result[i] == 0) ? "passed" : "failed");
 			}
+			return program.last_result[i];
+		}
 	}
-	else if (strcmp(curr->test, "TIMER") == 0)
+	if (program.fresh[i])
 	{
-		int timer_val = get_integer_value(variables, "TIMER");
-		int check_val = integer_value(variables, curr->check);
 		if (verbose() || action_tracing())
-			printf("timer check %d %d %d", timer_val, curr->operation, check_val);
-		if (perform_integer_compare(timer_val, curr->operation, check_val) )
+		{
+			display_condition(curr);
+			printf("fresh for %lds\n", program.due[i] - wheel_time);
+		}
+		return 0;
+	}
+	/* run this test */
+	if (verbose() || action_tracing()) 
+        display_condition(curr);
+
+	switch (program.opcode[i])
+	{
+	case OP_ASSIGN:
+		/* in this case, the command to execute is the RHS of our condition. */
+		if (program.check_ref[i] != NO_SYMBOL
+				&& copy_ref_value(variables, program.test_ref[i], program.check_ref[i]))
+			result = 0;
+		else if ((collected = timed_collect(variables, curr->check, program.check_ref[i])) != NULL)
+		{
+			program.bytes_collected[i] += shared_value_length(collected);
+			set_ref_shared_value(variables, program.test_ref[i], collected);
+			release_shared_value(collected);
+			result = 0; /* gotcha: 0 means success! */
+		}
+		if (result == 0)
+		{
+			if (program.refresh_interval[i])
+				schedule_refresh(i, program.refresh_interval[i]);
+			if (verbose() || action_tracing()) printf("\n");
+		}
+		return result;
+	case OP_TIMER:
+	{
+		int timer_val = get_ref_integer_value(variables, program.test_ref[i]);
+		int check_val = (program.check_ref[i] == NO_SYMBOL) 
+			? program.check_integer[i] : get_ref_integer_value(variables, program.check_ref[i]);
+		if (verbose() || action_tracing())
+			printf("timer check %d %d %d", timer_val, op, check_val);
+		if (perform_integer_compare(timer_val, op, check_val) )
 		{
 			result = 0;
 			if (verbose() || action_tracing())printf(" passed\n");
@@ -473,38 +1262,209 @@ static int check_one_condition(symbol_table variables, condition *curr)
 		else {
 			if (verbose() || action_tracing()) printf(" failed\n");
 		}
+		return result;
 	}
-	else if (is_comparison_op(curr->operation))
+	case OP_FAIL:
+		return result;
+	}
+
+	/* try to collect data using a variable or by running a plugin. */
+	if (program.test_ref[i] != NO_SYMBOL)
+		buf = read_ref_value(variables, program.test_ref[i], value_buf, &collected);
+	if (buf == NULL)
+	{
+		collected = timed_collect(variables, curr->test, program.test_ref[i]);
+		buf = (collected) ? shared_value_text(collected) : ""; 
+		if (collected)
+			program.bytes_collected[i] += shared_value_length(collected);
+	}
+	if (program.opcode[i] == OP_MATCH)
+		result = match_result(curr, execute_match(i, collected, buf));
+	else
 	{
-        /* if the rhs is a variable name, use the contents of the variable in the test */
-        const char *check_value = get_string_value(variables, curr->check);
-        if (check_value == NULL)
-            check_value = curr->check;
-		if (is_integer(buf))
-			result = perform_integer_compare(atoi(buf), curr->operation, atoi(check_value));
+		/* if the rhs is a variable name, use the contents of the variable in the test */
+		const char *check_value = (program.opcode[i] == OP_COMPARE) 
+			? ref_name_lookup(variables, program.check_ref[i]) : curr->check;
+		int lhs;
+		if (!parse_integer(buf, &lhs))
+			result = perform_string_compare(buf, op, check_value);
+		else if (program.opcode[i] == OP_COMPARE_INTEGER)
+			result = perform_integer_compare(lhs, op, program.check_integer[i]);
 		else
-			result = perform_string_compare(buf, curr->operation, check_value);
+			result = perform_integer_compare(lhs, op, atoi(check_value));
 		result = !result; /* cater for the strange intersion of return value for these conditions */
         if (verbose() || action_tracing())
             printf("%s\n", (result==0) ? " passed\n" : " failed\n");
 	}
-	if (buf != NULL)
-		free(buf);
+	release_shared_value(collected);
+	if (program.pure[i])
+	{
+		/* an undefined variable is run as a command, which may give a different answer next time */
+		program.memo_valid[i] = ref_is_defined(variables, program.test_ref[i]);
+		program.last_result[i] = result;
+		program.test_generation[i] = test_generation;
+		program.check_generation[i] = check_generation;
+	}
 	return result;
 }
 
 int check_condition(symbol_table variables, int set)
 {
-	condition *curr = condition_table;
-	while (curr != NULL) 
+	int k;
+	if (program_stale)
+		compile_conditions(variables);
+	for (k=0; k<program.length; k++)
 	{
-		if (curr->set == set) 
-			check_one_condition(variables, curr);
-	    curr = curr->next;
+		int i = program.order[k];
+		int *sets = program.set_list + program.first_set[i];
+		int j;
+		for (j=0; j<program.num_sets[i]; j++)
+			if (sets[j] == set)
+			{
+				run_instruction(variables, i);
+				break;
+			}
 	}
 	return 0;
 }
 
+static void record_latency(int i, long ns)
+{
+	int bucket = 0;
+	long n = ns;
+	while (n > 1 && bucket < LATENCY_BUCKETS - 1)
+	{
+		n >>= 1;
+		bucket++;
+	}
+	program.latency_histogram[i * LATENCY_BUCKETS + bucket]++;
+	if (program.timed_runs[i] == 0 || ns < program.min_ns[i])
+		program.min_ns[i] = ns;
+	if (ns > program.max_ns[i])
+		program.max_ns[i] = ns;
+	program.total_ns[i] += ns;
+	program.timed_runs[i]++;
+}
+
+/* the 99th percentile latency, as the upper end of its bucket */
+static long p99_latency(int i)
+{
+	unsigned long *histogram = program.latency_histogram + i * LATENCY_BUCKETS;
+	unsigned long limit = program.timed_runs[i] - program.timed_runs[i] / 100;
+	unsigned long seen = 0;
+	long result = program.max_ns[i];
+	int bucket;
+	for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+	{
+		seen += histogram[bucket];
+		if (seen >= limit)
+		{
+			result = 2L << bucket;
+			break;
+		}
+	}
+	if (result > program.max_ns[i])
+		result = program.max_ns[i];
+	if (result < program.min_ns[i])
+		result = program.min_ns[i];
+	return result;
+}
+
+static long mean_latency(int i)
+{
+	return (program.timed_runs[i]) ? (long)(program.total_ns[i] / program.timed_runs[i]) : 0;
+}
+
+/* the time spent in an instruction, estimated from the timed runs */
+static double total_latency(int i)
+{
+	return (double)mean_latency(i) * program.runs[i];
+}
+
+/* publish the statistics of instruction i after it has run. The byte count 
+   may not fit an integer variable, so it is given as text.
+ */
+static void publish_statistics(symbol_table variables, int i)
+{
+	symbol_ref *refs = program.stat_refs + i * NUM_STATS;
+	char bytes[32];
+	set_ref_integer_value(variables, refs[STAT_RUNS], program.runs[i]);
+	set_ref_integer_value(variables, refs[STAT_PASS_RATE], 
+			(program.runs[i]) ? program.passes[i] * 100 / program.runs[i] : 0);
+	set_ref_integer_value(variables, refs[STAT_AVG_US], mean_latency(i) / 1000);
+	set_ref_integer_value(variables, refs[STAT_MIN_US], program.min_ns[i] / 1000);
+	set_ref_integer_value(variables, refs[STAT_MAX_US], program.max_ns[i] / 1000);
+	set_ref_integer_value(variables, refs[STAT_P99_US], p99_latency(i) / 1000);
+	snprintf(bytes, sizeof(bytes), "%.0f", program.bytes_collected[i]);
+	set_ref_string_value(variables, refs[STAT_BYTES], bytes);
+}
+
+static int compare_total_latency(const void *a, const void *b)
+{
+	double t1 = total_latency(*(const int *)a);
+	double t2 = total_latency(*(const int *)b);
+	if (t1 > t2)
+		return -1;
+	if (t1 < t2)
+		return 1;
+	return program.source[*(const int *)a]->sequence - program.source[*(const int *)b]->sequence;
+}
+
+void display_condition_profile()
+{
+	int *by_time;
+	int i;
+	if (program.length == 0)
+		return;
+	by_time = malloc(program.length * sizeof(int));
+	for (i=0; i<program.length; i++)
+		by_time[i] = i;
+	qsort(by_time, program.length, sizeof(int), compare_total_latency);
+	printf("%10s %9s %5s %9s %9s %9s %9s %10s %5s  condition\n", 
+			"total ms", "runs", "pass%", "mean us", "min us", "max us", "p99 us", "bytes", "id");
+	for (i=0; i<program.length; i++)
+	{
+		int n = by_time[i];
+		condition *c = program.source[n];
+		printf("%10.1f %9lu %5lu %9.1f %9.1f %9.1f %9.1f %10.0f %5d  ", 
+				total_latency(n) / 1e6, program.runs[n], 
+				(program.runs[n]) ? program.passes[n] * 100 / program.runs[n] : 0,
+				mean_latency(n) / 1e3, program.min_ns[n] / 1e3, program.max_ns[n] / 1e3, 
+				p99_latency(n) / 1e3, program.bytes_collected[n], c->sequence);
+		if (c->operation == ASSIGNED)
+			printf("COLLECT %s FROM %s\n", c->test, c->check);
+		else
+			printf("%s %s %s\n", c->test, op_name(c->operation), 
+					(c->rexp) ? c->rexp->pattern : c->check);
+	}
+	free(by_time);
+}
+
+/* tests that are cheap for the number of sets they rule out come first. 
+   Ties keep the order the conditions were added in.
+ */
+static int compare_tests(const void *a, const void *b)
+{
+	int i = *(const int *)a;
+	int j = *(const int *)b;
+	double score1 = (double)(program.cost[i] + 1) * (program.failure_rate[j] + 1);
+	double score2 = (double)(program.cost[j] + 1) * (program.failure_rate[i] + 1);
+	if (score1 < score2)
+		return -1;
+	if (score1 > score2)
+		return 1;
+	return program.source[i]->sequence - program.source[j]->sequence;
+}
+
+/* sort the tests that follow the assignments at the start of the program */
+static void reorder_tests()
+{
+	int count = program.length - program.num_assignments;
+	if (count < 2)
+		return;
+	qsort(program.order + program.num_assignments, count, sizeof(int), compare_tests);
+}
+
 /**
   check conditions for all states to find a set which are currently valid. At present, all 
   conditions are checked, however this is not guaranteed. In the future, this process will
@@ -516,27 +1476,86 @@ int check_all_conditions(symbol_table variables)
 		never any condition numbered zero but we ignore that and prepare a 
 		slot anyway.
 	 */
-	int *failed = malloc((condition_set_number+1) * sizeof(int));
-	int *conditions_run = malloc((condition_set_number+1) * sizeof(int)); /* counts how many conditions were run for each state */
 	int i;
+	int k;
 	int result = -1;
-	condition *curr = condition_table;
-    int unknownStateConditionSet = get_integer_value(states, "UNKNOWN");
+	int measuring;
+	struct timespec cycle_start;
+    int unknownStateConditionSet;
+    if (unknown_state_ref == NO_SYMBOL)
+        bind_all_conditions(variables);
+	else if (program_stale)
+		compile_conditions(variables);
+    unknownStateConditionSet = get_ref_integer_value(states, unknown_state_ref);
 	
+	if (condition_set_space < condition_set_number + 1)
+	{
+		condition_set_space = condition_set_number + 1;
+		failed = realloc(failed, condition_set_space * sizeof(int));
+		/* counts how many conditions were run for each state */
+		conditions_run = realloc(conditions_run, condition_set_space * sizeof(int));
+	}
 	for (i=0; i<= condition_set_number; i++)
 	{
 		failed[i] = 0;
 		conditions_run[i] = 0;
 	}
     /* there is no way back to the start state */
-    failed[get_integer_value(states, "START")] = 1; 
-	while (curr != NULL) 
+    failed[get_ref_integer_value(states, start_state_ref)] = 1; 
+	clock_gettime(CLOCK_MONOTONIC, &cycle_start);
+	clear_result_cache();
+	if (++cycles_since_reorder >= REORDER_INTERVAL)
 	{
-		int res = check_one_condition(variables, curr);
-		conditions_run[curr->set]++;
-		if (res != 0)
-			failed[curr->set] = 1;
-		curr = curr->next;
+		reorder_tests();
+		cycles_since_reorder = 0;
+	}
+	measuring = (cycles_since_reorder % MEASUREMENT_INTERVAL) == 0;
+	advance_wheel(monotonic_seconds());
+	collect_in_parallel(variables);
+	for (k=0; k<program.length; k++)
+	{
+		/* each test is run once and its result is shared by the sets using it */
+		int n = program.order[k];
+		int *sets = program.set_list + program.first_set[n];
+		int num_sets = program.num_sets[n];
+		struct timespec start;
+		long ns = -1;
+		int res;
+		int needed = (program.opcode[n] == OP_ASSIGN);
+		for (i=0; !needed && i<num_sets; i++)
+			needed = !failed[sets[i]];
+		if (!needed)
+			continue; /* every state using this test has already been ruled out */
+		last_collection_ns = -1;
+		if (measuring)
+			clock_gettime(CLOCK_MONOTONIC, &start);
+		res = run_instruction(variables, n);
+		if (measuring)
+		{
+			ns = elapsed_ns(&start);
+			program.cost[n] += (ns - program.cost[n]) / AVERAGING_WEIGHT;
+		}
+		else if (last_collection_ns >= 0)
+			ns = last_collection_ns;
+		if (program.call_ns[n] >= 0)
+		{
+			/* the result was collected by a parallel call */
+			ns = program.call_ns[n];
+			program.call_ns[n] = -1;
+		}
+		if (ns >= 0)
+			record_latency(n, ns);
+		program.runs[n]++;
+		if (res == 0)
+			program.passes[n]++;
+		program.failure_rate[n] += (((res) ? FAILURE_SCALE : 0) - program.failure_rate[n]) / AVERAGING_WEIGHT;
+		for (i=0; i<num_sets; i++)
+		{
+			conditions_run[sets[i]]++;
+			if (res != 0)
+				failed[sets[i]] = 1;
+		}
+		publish_statistics(variables, n);
 	}
     {
         int max = 0;
@@ -559,29 +1578,31 @@ int check_all_conditions(symbol_table variables)
     }
 	if (result == -1) /* no states match, switch to the unknown state */
 		result = unknownStateConditionSet;
-	free(failed);
-	free(conditions_run);
+	set_ref_integer_value(variables, cycle_time_ref, elapsed_ns(&cycle_start) / 1000);
 	return result;
 }
 
 void release_condition_set(int set)
 {
-	/* remove all entries matching this set */
-	condition *curr = condition_table;
-	while (curr != NULL) 
+	/* remove the set from all conditions, and the conditions nobody else uses */
+	condition **prev = &condition_table;
+	while (*prev != NULL) 
 	{
-		if (curr->set == set) 
+		condition *curr = *prev;
+		int i;
+		int n = 0;
+		for (i=0; i<curr->num_sets; i++)
+			if (curr->sets[i] != set)
+				curr->sets[n++] = curr->sets[i];
+		curr->num_sets = n;
+		if (n == 0)
 		{
-			condition *old = curr;
-
-			/* special case removal from the head of the list */
-			if (old == condition_table)
-				condition_table = condition_table->next;
-				
-			free(old->test);
-		    free(old->check);
-			free(old);
+			*prev = curr->next;
+			free_condition(curr);
+			num_entries--;
 		}
-	    curr = curr->next;
+		else
+			prev = &curr->next;
 	}
+	program_stale = 1;
 }
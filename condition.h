@@ -40,10 +40,26 @@ void release_all_conditions();
 
 void display_all_conditions();
 
+/* print how long each condition has taken, the slowest first */
+void display_condition_profile();
+
 int create_condition_set();
 
 void add_condition(int set, const char *test, int op, const char *check, parameter_list params);
 
+/* as add_condition(), for a collection that need only be made every refresh_interval seconds */
+void add_periodic_condition(int set, const char *test, int op, const char *check, 
+		parameter_list params, int refresh_interval);
+
+/* resolve the variable names used by all conditions to symbol references */
+void bind_all_conditions(symbol_table variables);
+
+/* treat the value of a collected variable as fresh, eg when it has been restored 
+   from the variable store, so that it is not collected again until its refresh 
+   interval has passed, or for a second if it has none
+ */
+void keep_collected_value(symbol_ref ref);
+
 int check_condition(symbol_table variables, int set);
 
 int check_all_conditions(symbol_table variables);
@@ -40,6 +40,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "buffers.h"
 #include "options.h"
 #include "regular_expressions.h"
+#include "numbers.h"
 
 #include "plugin.h"
 #include "property.h"
@@ -99,13 +100,14 @@ nodeType * ex(nodeType *p) {
         case typeId:        
             {
                 const char *val;
+                int n;
                 if ( strcmp(p->node.sym.name, "random") == 0)
                     return constant(random());
                 val = get_string_value(variables, p->node.sym.name);
                 if (!val)
                     val = "";
-                if (is_integer(val))
-                    a = constant(get_integer_value(variables, p->node.sym.name));
+                if (parse_integer(val, &n))
+                    a = constant(n);
                 else
                     a = string_constant(strdup(val));
                 return a;
@@ -389,12 +389,15 @@ void process_dir(struct traversal_info *orig_ti, const char *path, handler *hand
 	}
 }
 
+static const char *plugin_properties[] = { "MATCH" };
+static property_key_set plugin_keys = PROPERTY_KEY_SET(plugin_properties);
+
 EXPORT
 char *plugin_func(symbol_table variables, char *buf, int buflen, int argc, char *argv[])
 {
 	struct traversal_info *ti;
 	int i;
-	const char *filename_pattern = lookup_string_property(variables, argv[0], "MATCH", "");
+	const char *filename_pattern = lookup_key_string(group_keys(&plugin_keys, variables, argv[0])[0], "");
 	ti = new_traversal();
 	if (strlen(filename_pattern))
 	{
@@ -47,12 +47,25 @@ static symbol_table variables;
 
 static int method_id_number;
 
+/* references to the variables that methods use implicitly */
+static symbol_ref result_ref;
+static symbol_ref result_status_ref;
+static symbol_ref rexp_0_ref;
+static symbol_ref trace_steps_ref;
+
 void init_methods(symbol_table variables_table)
 {
   method_id_number = 0;
   method_table = NULL;
   num_entries = 0;
   variables = variables_table;
+  if (variables)
+  {
+    result_ref = bind_symbol(variables, "RESULT");
+    result_status_ref = bind_symbol(variables, "RESULT_STATUS");
+    rexp_0_ref = bind_symbol(variables, "REXP_0");
+    trace_steps_ref = bind_symbol(variables, "TRACE_STEPS");
+  }
 }
 
 char *action_name(enum action_type action)
@@ -110,6 +123,9 @@ void release_all_methods()
     free(curr->action);
     free_parameter_list(curr->parameters);
     if (curr->params) free(curr->params);
+    free(curr->param_refs);
+    free(curr->parameter_refs);
+    if (curr->rexp) release_pattern(curr->rexp);
     free(curr);
     curr = method_table;
   }
@@ -168,9 +184,118 @@ method *create_typed_action(int id, enum action_type kind, const char *action)
   new_method->action = strdup(action);
   new_method->params = NULL;
   new_method->parameters = init_parameter_list(4);
+  new_method->bound = 0;
+  new_method->action_ref = NO_SYMBOL;
+  new_method->param_refs = NULL;
+  new_method->parameter_refs = NULL;
+  new_method->function_ref = NO_SYMBOL;
+  new_method->rexp = NULL;
   return new_method;
 }
 
+/* the compiled pattern is kept with the method and only compiled again if the
+   pattern changes. It is taken from the method while in use in case the method
+   is run again by an EACH.
+ */
+static rexp_info *take_pattern(method *m, const char *pattern)
+{
+  rexp_info *info = m->rexp;
+  m->rexp = NULL;
+  if (info && strcmp(info->pattern, pattern) == 0)
+    return info;
+  if (info)
+    release_pattern(info);
+  return create_pattern(pattern);
+}
+
+static void keep_pattern(method *m, rexp_info *info)
+{
+  if (m->rexp)
+    release_pattern(m->rexp);
+  m->rexp = info;
+}
+
+static symbol_ref *bind_names(char **names)
+{
+  symbol_ref *result;
+  int count = 0;
+  int i;
+  if (!names) return NULL;
+  while (names[count]) count++;
+  result = malloc( (count+1) * sizeof(symbol_ref));
+  for (i=0; i<count; i++)
+    result[i] = bind_symbol(variables, names[i]);
+  result[count] = NO_SYMBOL;
+  return result;
+}
+
+/* resolve the names used by a method to symbol references so that
+   executing the method does not need to search the symbol table.
+ */
+static void bind_method(method *m)
+{
+  char *function_name;
+  free(m->param_refs);
+  free(m->parameter_refs);
+  m->param_refs = bind_names(m->params);
+  m->parameter_refs = bind_names(m->parameters->elements);
+  switch (m->kind)
+  {
+  case SET_ACTION:
+  case TRIM_ACTION:
+  case LINE_ACTION:
+  case RUN_ACTION:
+  case SPAWN_ACTION:
+    m->action_ref = bind_symbol(variables, m->action);
+    break;
+  case GENERIC_ACTION:
+    /* the function name given to EACH and DO is usually a literal */
+    function_name = NULL;
+    if (strcmp(m->action, "EACH") == 0 && m->params && m->params[0] && m->params[1]
+        && m->params[2] && m->params[3])
+      function_name = m->params[3];
+    else if (strcmp(m->action, "DO") == 0 && m->params && m->params[0])
+      function_name = m->params[0];
+    if (function_name)
+    {
+      char *full_name = malloc(strlen("FUNCTION_") + strlen(function_name) + 1);
+      sprintf(full_name, "FUNCTION_%s", function_name);
+      m->function_ref = bind_symbol(variables, full_name);
+      free(full_name);
+    }
+    break;
+  default:
+    break;
+  }
+  m->bound = 1;
+}
+
+void bind_all_methods()
+{
+  method *curr = method_table;
+  while (curr != NULL)
+  {
+    bind_method(curr);
+    curr = curr->next;
+  }
+}
+
+/* find the method id of a named function, the name may be given by a variable */
+static int function_method_id(method *m, int param)
+{
+  char *function_name;
+  const char *short_name;
+  int result;
+  if (!ref_is_defined(variables, m->param_refs[param]) && m->function_ref != NO_SYMBOL)
+    return get_ref_integer_value(variables, m->function_ref);
+  short_name = ref_name_lookup(variables, m->param_refs[param]);
+  function_name = malloc(strlen("FUNCTION_") + strlen(short_name) + 1);
+  sprintf(function_name, "FUNCTION_%s", short_name);
+  result = get_integer_value(variables, function_name);
+  free(function_name);
+  return result;
+}
+
 void add_method_parameters(method *m, parameter_list params)
 {
   int i;
@@ -374,7 +499,7 @@ void trim(char *value)
 
 struct my_match_data
 {
-  const char *symbol_name;
+  symbol_ref symbol;
   int method_id;
 };
 
@@ -385,18 +510,18 @@ int each_match_do(const char *match, void *data )
   if (info && info->method_id > 0)
   {
     char *new_result;
-    const char *old_result = get_string_value(variables, "RESULT");
-    char *saved_result;
-    if (old_result)
-      saved_result = strdup(old_result);
-    else
-      saved_result = strdup("");
-    set_string_value(variables, info->symbol_name, match);
+    /* hold on to the accumulated result while the function runs, without copying it */
+    shared_value saved_result = get_ref_shared_value(variables, result_ref);
+    const char *function_result;
+    set_ref_string_value(variables, info->symbol, match);
     return_val = execute_method(info->method_id);
-    asprintf(&new_result, "%s%s", saved_result, get_string_value(variables, "RESULT"));
-    saved_result = replace_buffer(saved_result, new_result);
-    set_string_value(variables, "RESULT", saved_result);
-    free(saved_result);
+    function_result = get_ref_string_value(variables, result_ref);
+    asprintf(&new_result, "%s%s", (saved_result) ? shared_value_text(saved_result) : "",
+             (function_result) ? function_result : "");
+    release_shared_value(saved_result);
+    saved_result = adopt_shared_value(new_result);
+    set_ref_shared_value(variables, result_ref, saved_result);
+    release_shared_value(saved_result);
   }
   return return_val;
 }
@@ -416,6 +541,8 @@ int execute_method(int id)
   {
     if (curr->id == id)
     {
+      if (!curr->bound)
+        bind_method(curr);
       if (action_tracing())
       {
         if (curr->kind != GENERIC_ACTION
@@ -472,21 +599,21 @@ int execute_method(int id)
           if (strcmp(curr->params[0], "-p") == 0)
           {
             idx++; /* skip the -p */
-            pattern = name_lookup(variables, curr->params[idx++]);
+            pattern = ref_name_lookup(variables, curr->param_refs[idx++]);
           }
           else
             pattern = curr->params[idx++];
-          text = name_lookup(variables, curr->params[idx++]);
-          info = create_pattern(pattern);
+          text = ref_name_lookup(variables, curr->param_refs[idx++]);
+          info = take_pattern(curr, pattern);
           if (find_matches(info, variables, text) == 0)
           {
-            const char *matched = get_string_value(variables, "REXP_0");
+            const char *matched = get_ref_string_value(variables, rexp_0_ref);
             if (!matched) matched = ""; /* surely this cannot happen */
-            set_string_value(variables, "RESULT", matched);
+            set_ref_string_value(variables, result_ref, matched);
           }
           else
-            set_string_value(variables, "RESULT", "fail");
-          release_pattern(info);
+            set_ref_string_value(variables, result_ref, "fail");
+          keep_pattern(curr, info);
         }
         else if (strcmp(curr->action, "REPLACE") == 0 )
         {
@@ -499,66 +626,61 @@ int execute_method(int id)
           if (strcmp(curr->params[0], "-p") == 0)
           {
             idx++;
-            pattern = name_lookup(variables, curr->params[idx++]);
+            pattern = ref_name_lookup(variables, curr->param_refs[idx++]);
           }
           else
             pattern = curr->params[idx++];
-          text = name_lookup(variables, curr->params[idx++]);
-          subst = name_lookup(variables, curr->params[idx++]);
+          text = ref_name_lookup(variables, curr->param_refs[idx++]);
+          subst = ref_name_lookup(variables, curr->param_refs[idx++]);
 
-          info = create_pattern(pattern);
+          info = take_pattern(curr, pattern);
           new_text = substitute_pattern(info, variables, text, subst);
           if (new_text)
-            set_string_value(variables, "RESULT", new_text);
+            set_ref_string_value(variables, result_ref, new_text);
           else
-            set_string_value(variables, "RESULT", "");
+            set_ref_string_value(variables, result_ref, "");
           free(new_text);
-          release_pattern(info);
+          keep_pattern(curr, info);
 
         }
         else if (strcmp(curr->action, "INTERPRET") == 0 )
         {
-          const char *text = name_lookup(variables, curr->params[0]);
-          const char *properties = name_lookup(variables, curr->params[1]);
+          const char *text = ref_name_lookup(variables, curr->param_refs[0]);
+          const char *properties = ref_name_lookup(variables, curr->param_refs[1]);
           interpret_text(variables, properties, "RESULT", text);
         }
         else if (strcmp(curr->action, "EACH") == 0 )
         {
           struct my_match_data data;
-          const char *pattern = name_lookup(variables, curr->params[1]);
-          const char *text = name_lookup(variables, curr->params[2]);
-          const char *short_name = name_lookup(variables, curr->params[3]);
-          char *function_name = malloc(strlen("FUNCTION_") + strlen(short_name) + 1);
-          data.symbol_name = curr->params[0]; /* variable name; don't look for its value */
-          sprintf(function_name, "FUNCTION_%s", short_name);
-
-          data.method_id = get_integer_value(variables, function_name);
-          free(function_name);
-          set_string_value(variables, "RESULT", "");
+          const char *pattern = ref_name_lookup(variables, curr->param_refs[1]);
+          const char *text = ref_name_lookup(variables, curr->param_refs[2]);
+          data.symbol = curr->param_refs[0]; /* variable name; don't look for its value */
+          data.method_id = function_method_id(curr, 3);
+          set_ref_string_value(variables, result_ref, "");
           if (data.method_id > 0)
           {
-            rexp_info *info = create_pattern(pattern);
+            rexp_info *info = take_pattern(curr, pattern);
             each_match(info, text, each_match_do, &data);
-            release_pattern(info);
+            keep_pattern(curr, info);
           }
         }
         else if (strcmp(curr->action, "DO") == 0 )
         {
-          int method_id;
-          const char *short_name = name_lookup(variables, curr->params[0]);
-          char *function_name = malloc(strlen("FUNCTION_") + strlen(short_name) + 1);
-          sprintf(function_name, "FUNCTION_%s", short_name);
-          method_id = get_integer_value(variables, function_name);
-          free(function_name);
-          if (curr->params[1])
+          int method_id = function_method_id(curr, 0);
+          if (curr->params[1] && strncmp(curr->params[1], "PARAM", 5) == 0)
           {
-
+            /* the parameters overlap the group being copied, take a copy first */
             symbol_table method_params = collect_properties(variables, curr->params[1]);
-            remove_matching(variables, "^PARAM_");
+            remove_symbols_with_prefix(variables, "PARAM_");
             each_property(method_params, curr->params[1], copy_property, NULL);
             free_symbol_table(method_params);
           }
-          set_string_value(variables, "RESULT", "");
+          else if (curr->params[1])
+          {
+            remove_symbols_with_prefix(variables, "PARAM_");
+            each_property(variables, curr->params[1], copy_property, NULL);
+          }
+          set_ref_string_value(variables, result_ref, "");
           if (method_id > 0)
             execute_method(method_id);
         }
@@ -572,7 +694,7 @@ int execute_method(int id)
           if (curr->parameters)
           {
             for (i=0; i<curr->parameters->used; i++)
-              printf("%s", name_lookup(variables, curr->parameters->elements[i]));
+              printf("%s", ref_name_lookup(variables, curr->parameter_refs[i]));
             printf("\n");
           }
         }
@@ -582,14 +704,14 @@ int execute_method(int id)
 
       case TRIM_ACTION:
       {
-        const char *old_value = get_string_value(variables, curr->action);
+        const char *old_value = get_ref_string_value(variables, curr->action_ref);
         char *value;
         if (!old_value || strlen(old_value) == 0)
           break;
         value = strdup(old_value);
         {
           trim(value);
-          set_string_value(variables, curr->action, value);
+          set_ref_string_value(variables, curr->action_ref, value);
         }
         free(value);
       }
@@ -601,13 +723,13 @@ int execute_method(int id)
           char **elements = duplicate_params(curr->parameters->elements);
           int plugin_result = plugin(variables, curr->parameters->elements[0], elements);
           release_params(elements);
-          set_integer_value(variables, "RESULT_STATUS", plugin_result);
+          set_ref_integer_value(variables, result_status_ref, plugin_result);
         }
         else
         {
           fprintf(stderr, "Warning: call action is missing parameters\n");
           int plugin_result = plugin(variables, curr->action, NULL);
-          set_integer_value(variables, "RESULT_STATUS", plugin_result);
+          set_ref_integer_value(variables, result_status_ref, plugin_result);
         }
 
       }
@@ -623,8 +745,8 @@ int execute_method(int id)
         char **newparams;
         int child;
         char *tmpfile = new_temp_filename("/tmp/mon-", ".txt");
-        const char *program = get_string_value(variables, curr->action);
-        set_integer_value(variables, "RESULT_STATUS", 0);
+        const char *program = get_ref_string_value(variables, curr->action_ref);
+        set_ref_integer_value(variables, result_status_ref, 0);
         if (!program)
           program = curr->action;
         cmd_str = malloc(strlen(program) + strlen(tmpfile) + 5);
@@ -677,23 +799,23 @@ int execute_method(int id)
           }
           if (stat == 0)
           {
-            set_integer_value(variables, "RESULT_STATUS", 0);
+            set_ref_integer_value(variables, result_status_ref, 0);
           }
           else if (WIFEXITED(stat))
           {
-            set_integer_value(variables, "RESULT_STATUS", WEXITSTATUS(stat));
+            set_ref_integer_value(variables, result_status_ref, WEXITSTATUS(stat));
             if (verbose()) printf("%s returned (exit %d): %d\n", 
               program, WEXITSTATUS(stat), stat);
           }
           else if (WIFSIGNALED(stat))
           {
-            set_integer_value(variables, "RESULT_STATUS", WTERMSIG(stat));
+            set_ref_integer_value(variables, result_status_ref, WTERMSIG(stat));
             if (verbose()) printf("%s returned (signal %d): %d\n",
                                     program, WTERMSIG(stat), stat);
           }
           else if (WIFSTOPPED(stat))
           {
-            set_integer_value(variables, "RESULT_STATUS", WSTOPSIG(stat));
+            set_ref_integer_value(variables, result_status_ref, WSTOPSIG(stat));
             if (verbose()) printf("%s returned (stop signal): %d\n", program, stat);
           }
           release_params(newparams);
@@ -706,12 +828,12 @@ int execute_method(int id)
         res = unlink(tmpfile);
         free(tmpfile);
         {
-          const char *res = get_string_value(variables, curr->params[0]);
+          const char *res = get_ref_string_value(variables, curr->param_refs[0]);
           if (res && strlen(res) > 1 && res[strlen(res)-1] == '\n')
           {
             char *new_val = strdup(res);
             new_val[strlen(new_val)-1] = 0;
-            set_string_value(variables, curr->params[0], new_val);
+            set_ref_string_value(variables, curr->param_refs[0], new_val);
             free(new_val);
           }
         }
@@ -722,7 +844,7 @@ int execute_method(int id)
         int child;
         char **parameters;
         char **newenv = copy_environment();
-        const char *program = get_string_value(variables, curr->action);
+        const char *program = get_ref_string_value(variables, curr->action_ref);
         if (!program)
           program = curr->action;
         parameters = split_string(program);
@@ -767,40 +889,49 @@ int execute_method(int id)
       break;
       case SET_ACTION:
       {
-        if (curr->parameters)
+        if (curr->parameters && curr->parameters->used == 1)
+        {
+          if (ref_is_defined(variables, curr->parameter_refs[0]))
+            copy_ref_value(variables, curr->action_ref, curr->parameter_refs[0]);
+          else
+            set_ref_string_value(variables, curr->action_ref,
+                                 ref_name_lookup(variables, curr->parameter_refs[0]));
+        }
+        else if (curr->parameters)
         {
+          /* the joined value may itself name a variable so it cannot be bound in advance */
           int i;
           char *tmp = NULL;
           char *val = strdup("");
           for (i=0; i<curr->parameters->used; i++)
           {
-            asprintf(&tmp, "%s%s", val, name_lookup(variables, curr->parameters->elements[i]));
+            asprintf(&tmp, "%s%s", val, ref_name_lookup(variables, curr->parameter_refs[i]));
             val = replace_buffer(val, tmp);
           }
           if (curr->parameters->used > 1)
-            set_string_value(variables, curr->action, name_lookup(variables, val));
+            set_ref_string_value(variables, curr->action_ref, name_lookup(variables, val));
           else
-            set_string_value(variables, curr->action, val);
+            set_ref_string_value(variables, curr->action_ref, val);
           free(val);
         }
         else
         {
-          const char *rhs_value = name_lookup(variables, curr->params[0]);
+          const char *rhs_value = ref_name_lookup(variables, curr->param_refs[0]);
           if (verbose())
             printf("setting %s to %s (%s)\n", curr->action, curr->params[0],
                    (rhs_value) ? rhs_value : "");
-          set_string_value(variables, curr->action, rhs_value);
+          set_ref_string_value(variables, curr->action_ref, rhs_value);
         }
-        if ( strcmp(curr->action, "TRACE_STEPS") == 0)
-          set_action_tracing(get_integer_value(variables, "TRACE_STEPS"));
+        if (curr->action_ref == trace_steps_ref)
+          set_action_tracing(get_ref_integer_value(variables, trace_steps_ref));
 
       }
       break;
       case LINE_ACTION:
       {
         int linenum = 0;
-        const char *lookup = get_string_value(variables, curr->params[0]);
-        const char *data = get_string_value(variables, curr->action);
+        const char *lookup = get_ref_string_value(variables, curr->param_refs[0]);
+        const char *data = get_ref_string_value(variables, curr->action_ref);
         char *result = NULL;
         if (!data)
           data = curr->action;
@@ -812,7 +943,7 @@ int execute_method(int id)
         if (verbose())
           printf("getting line %d of %s\n", linenum, data);
         result = select_line(linenum, data);
-        set_string_value(variables, "RESULT", result);
+        set_ref_string_value(variables, result_ref, result);
         free(result);
       }
       break;
@@ -826,7 +957,7 @@ int execute_method(int id)
       }
       if (action_tracing())
       {
-        const char *action_result = get_string_value(variables, "RESULT");
+        const char *action_result = get_ref_string_value(variables, result_ref);
         if (action_result) printf("RESULT: %s", action_result);
         printf("\n");
       }
@@ -863,6 +994,9 @@ void release_method(int id)
         }
       }
       free(old->params);
+      free(old->param_refs);
+      free(old->parameter_refs);
+      if (old->rexp) release_pattern(old->rexp);
       free(old);
     }
     curr = curr->next;
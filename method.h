@@ -26,6 +26,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "symboltable.h"
 #include "buffers.h"
+#include "regular_expressions.h"
 
 enum action_type {
 	NULL_ACTION,      /* do nothing */
@@ -57,6 +58,13 @@ typedef struct method
 	char *action;
 	char **params; /* deprecated */
     parameter_list parameters;
+	/* symbol references resolved by bind_method() */
+	int bound;
+	symbol_ref action_ref;
+	symbol_ref *param_refs; /* one for each entry in params */
+	symbol_ref *parameter_refs; /* one for each entry in parameters */
+	symbol_ref function_ref; /* FUNCTION_xxx for EACH and DO */
+	rexp_info *rexp; /* the pattern last used by MATCH, REPLACE or EACH */
 } method;
 
 void init_actions();
@@ -67,6 +75,9 @@ void release_all_methods();
 
 void display_all_methods();
 
+/* resolve the variable names used by all methods to symbol references */
+void bind_all_methods();
+
 void add_method_parameters(method *m, parameter_list params);
 
 void add_method_parameter(method *m, const char *param);
@@ -38,7 +38,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "condition.h"
 #include "method.h"
 #include "method.h"
+#include "state_registry.h"
+#include "monitor_cycle.h"
+#include "variable_store.h"
 #include "plugin.h"
+#include "property.h"
 #include "options.h"
 #include "version.h"
 #include "splitstring.h"
@@ -68,6 +72,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   void clear_current();
 
   void new_simple_condition(const char *lhs, int op, const char *rhs, parameter_list params);
+  void new_periodic_collection(const char *lhs, const char *rhs, parameter_list params, const char *interval);
   void new_pattern_condition(const char *lhs, const char *pattern);
   void new_inverted_pattern_condition(const char *lhs, const char *pattern);
 
@@ -90,7 +95,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 %token NOT SET AND OR SQUOTE LOG RESTART /*TOK_FILE*/ TOK_EXIT
 %token PROPERTY DEFINE COLLECT FROM TEST EXECUTE SPAWN RUN
 %token CALL TRIM LINE OF USING MATCH IN REPLACE WITH INTERPRET
-%token JOINED EACH DO FUNCTION MATCHING VERSION
+%token JOINED EACH DO FUNCTION MATCHING VERSION EVERY
 
 
 /* if you have an old bison or a real yacc, the %error-verbose setting will give
@@ -152,6 +157,7 @@ STATE WORD
   current_handler = create_method();
   current_conditions = set_current_state($2.sVal);
   set_integer_value(states, current_state, current_conditions);
+  register_state(current_conditions, current_state);
   new_symbol("STATE", current_state, current_conditions);
   free($2.sVal);
 }
@@ -189,6 +195,8 @@ PROPERTY WORD
 {
   current_handler = set_current_method("ALIAS", $2.sVal);
   new_symbol("ALIAS", current_method, current_handler);
+  /* the descriptor follows the definitions that come next */
+  describe_plugin(variables, $2.sVal);
   free($2.sVal);
 }
 ;
@@ -454,6 +462,12 @@ COLLECT WORD FROM strval		{ new_simple_condition($2.sVal, ASSIGNED, $4.sVal, par
                             free($4.sVal);
                             params = NULL;
                           }
+| COLLECT WORD FROM strval EVERY NUMBER	{ new_periodic_collection($2.sVal, $4.sVal, params, $6.sVal);
+                            free($2.sVal);
+                            free($4.sVal);
+                            free($6.sVal);
+                            params = NULL;
+                          }
 ;
 
 strval:
@@ -644,6 +658,12 @@ void new_simple_condition(const char *lhs, int op, const char *rhs, parameter_li
   add_condition(current_conditions, lhs, op, rhs, params);
 }
 
+/* the collected value is kept for the given number of seconds before collecting again */
+void new_periodic_collection(const char *lhs, const char *rhs, parameter_list params, const char *interval)
+{
+  add_periodic_condition(current_conditions, lhs, ASSIGNED, rhs, params, atoi(interval));
+}
+
 void new_pattern_condition(const char *lhs, const char *pattern)
 {
   add_condition(current_conditions, lhs, MATCHES, pattern, NULL);
@@ -671,6 +691,7 @@ char *swap(char *a, char *b)
 
 
 int done = 0;
+static volatile sig_atomic_t profile_requested = 0;
 
 static void finish(int sig)
 {
@@ -690,6 +711,7 @@ static void showstate(int sig)
 {
   if (active_state)
     printf("Current state: %s\n", active_state);
+  profile_requested = 1; /* the conditions may be running, report from the main loop */
 }
 
 void process_method(const char *name)
@@ -743,7 +765,7 @@ void setup_signals()
 
 void usage(int argc, char *argv[])
 {
-  fprintf(stderr, "Usage: %s [-v] [-t] [-l logfilename] [-s maxlogfilesize] \n", argv[0]);
+  fprintf(stderr, "Usage: %s [-v] [-t] [-l logfilename] [-s maxlogfilesize] [-p storefilename] \n", argv[0]);
 }
 
 int main(int argc, char *argv[])
@@ -755,9 +777,13 @@ int main(int argc, char *argv[])
   time_t now;
   struct timeval now_tv;
   const char *logfilename = NULL;
+  const char *storefilename = NULL;
   int maxlogsize = 20000;
   pid_t err;
   int retain_terminal = 0;
+  /* variables used by the main loop */
+  symbol_ref system_delay_ref, last_ref, show_state_changes_ref;
+  monitor_cycle cycle;
 
 
   tzset(); /* this initialises the tz info required by ctime().  */
@@ -779,6 +805,8 @@ int main(int argc, char *argv[])
       logfilename = argv[++i];
     else if (strcmp(argv[i], "-s") == 0 && i < argc-1)
       maxlogsize = strtol(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-p") == 0 && i < argc-1)
+      storefilename = argv[++i];
     else if (*(argv[i]) == '-' && strlen(argv[i]) > 1)
     {
       usage(argc, argv);
@@ -811,6 +839,7 @@ int main(int argc, char *argv[])
 
   init_methods(variables);
   init_conditions();
+  init_state_registry();
 
   set_integer_value(variables, "SYSTEM_DELAY", 10);
   start_state = create_condition_set();
@@ -822,6 +851,8 @@ int main(int argc, char *argv[])
   set_integer_value(variables, "STATE_UNKNOWN", unknown_state);
   set_integer_value(states, "START", start_state);
   set_integer_value(states, "UNKNOWN", unknown_state);
+  register_state(start_state, "START");
+  register_state(unknown_state, "UNKNOWN");
   set_integer_value(variables, "TIME", timer_val);
 
   /* load configuration from files named on the commandline */
@@ -849,7 +880,8 @@ int main(int argc, char *argv[])
       yylineno = 1;
       yyparse();
     }
-    else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "-s") == 0) i++;
+    else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "-s") == 0 
+        || strcmp(argv[i], "-p") == 0) i++;
     i++;
   }
 
@@ -863,6 +895,22 @@ int main(int argc, char *argv[])
     exit(2);
   }
 
+  /* resolve variable names now so that the main loop does not search for them */
+  bind_all_methods();
+  bind_all_conditions(variables);
+  bind_state_methods(variables);
+  system_delay_ref = bind_symbol(variables, "SYSTEM_DELAY");
+  last_ref = bind_symbol(variables, "LAST");
+  show_state_changes_ref = bind_symbol(variables, "SHOW_STATE_CHANGES");
+
+  if (storefilename)
+  {
+    if (open_variable_store(storefilename) == 0)
+      persist_property_group(variables, "PERSISTENT");
+    else
+      fprintf(stderr, "Warning: failed to open variable store %s: %s\n", storefilename, strerror(errno));
+  }
+
   time(&now);
 #ifdef MONSTATE_VERSION
   printf("\n%s Version %s-%d loaded at %s\n", argv[0], MONSTATE_VERSION, BUILD_NUMBER,  ctime(&now));
@@ -882,25 +930,25 @@ int main(int argc, char *argv[])
     /* install these handlers so we can produce a report */
     signal(SIGINT, finish);
     signal(SIGTERM, finish);
-    set_integer_value(variables, "SHOW_STATE_CHANGES", 1);
+    set_ref_integer_value(variables, show_state_changes_ref, 1);
   }
   else
   {
-    set_integer_value(variables, "SHOW_STATE_CHANGES", 0);
+    set_ref_integer_value(variables, show_state_changes_ref, 0);
   }
 
-  active_state = "START";
+  init_monitor_cycle(&cycle, variables, start_state);
+  cycle.timer_val = timer_val; /* the start state was entered when the monitor started */
+  active_state = cycle.active->name;
   signal(SIGUSR1, debug);
   signal(SIGUSR2, showstate);
   process_method("ENTRY_START");
-  set_string_value(variables, "LAST", "");
+  /* saved values replace the initial values given by ENTRY START and are not collected again */
+  restore_variables(variables, keep_collected_value);
+  set_ref_string_value(variables, last_ref, "");
   while (!done)
   {
-    int method_id;
-    int next_state;
-    int method_result = 0;
-    const char *next_state_name;
-    char *method_name;
+    int method_result;
     int delay = 0;
 
     if (ftell(stdout) > maxlogsize)
@@ -912,48 +960,17 @@ int main(int argc, char *argv[])
     if (verbose())
       printf("\n\nIn state %s\n", active_state);
 
-    next_state = check_all_conditions(variables);
-    next_state_name = find_symbol_with_int_value(states, next_state);
-    set_integer_value(variables, "TIME", time(NULL));
-    {
-      int tracing;
-      if ( (tracing = get_integer_value(variables, "TRACE_STEPS")) != action_tracing() )
-        set_action_tracing( tracing );
-    }
-    if (next_state_name != NULL && strcmp(next_state_name, active_state) != 0)
+    method_result = run_monitor_cycle(&cycle);
+    active_state = cycle.active->name;
+    if (profile_requested)
     {
-      /* change states and run the entry method */
-      if (verbose())
-        printf("next state: %s (%d)\n", next_state_name , next_state);
-      method_name = new_joined_string("ENTRY", '_', next_state_name);
-      method_id = get_integer_value(variables, method_name);
-      timer_val = time(NULL);
-      set_integer_value(variables, "TIMER", 0);
-      if ( get_integer_value(variables, "SHOW_STATE_CHANGES") )
-      {
-        printf("changing state to %s\n", next_state_name);
-        fflush(stdout);
-      }
-      if (method_id > 0)
-        method_result = execute_method(method_id);
-      free(method_name);
-      set_string_value(variables, "LAST", active_state);
-      active_state = next_state_name;
-      set_string_value(variables, "CURRENT", active_state);
-    }
-    else
-    {
-      /* run the poll method */
-      method_name = new_joined_string("POLL", '_', active_state);
-      method_id = get_integer_value(variables, method_name);
-      set_string_value(variables, "CURRENT", active_state);
-      set_integer_value(variables, "TIMER", time(NULL) - timer_val);
-      if (method_id > 0)
-        method_result = execute_method(method_id);
-      free(method_name);
+      profile_requested = 0;
+      display_state_registry();
+      display_condition_profile();
+      fflush(stdout);
     }
 
-    delay = get_integer_value(variables, "SYSTEM_DELAY");
+    delay = get_ref_integer_value(variables, system_delay_ref);
     if (delay <= 0) delay = 0; /* just in case. */
 
     if (method_result == -1)
@@ -963,14 +980,6 @@ int main(int argc, char *argv[])
       usleep(20000L);
     else
       sleep(delay);
-
-    {
-      const char *debug_on = get_string_value(variables, "DEBUG");
-      if (debug_on && strcmp(debug_on, "true") == 0)
-        set_verbose(1);
-      else if (debug_on && strcmp(debug_on, "false") == 0)
-        set_verbose(0);
-    }
   }
   if ( verbose())
   {
@@ -980,10 +989,18 @@ int main(int argc, char *argv[])
     printf("\nconditions\n");
     display_all_conditions();
   }
+  printf("\nstates\n");
+  display_state_registry();
+  printf("\ncondition profile\n");
+  display_condition_profile();
   release_plugins();
+  release_plugin_descriptors();
 
   release_all_conditions();
   release_all_methods();
+  release_state_registry();
+  close_variable_store();
+  release_property_keys();
   free_symbol_table(states);
   free_symbol_table(variables);
   return 0;
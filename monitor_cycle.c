@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "monitor_cycle.h"
+#include "condition.h"
+#include "method.h"
+#include "variable_store.h"
+#include "options.h"
+
+void init_monitor_cycle(monitor_cycle *cycle, symbol_table variables, int start_state)
+{
+	cycle->variables = variables;
+	cycle->active = find_state(start_state);
+	cycle->timer_val = time(NULL);
+	cycle->time_ref = bind_symbol(variables, "TIME");
+	cycle->timer_ref = bind_symbol(variables, "TIMER");
+	cycle->current_ref = bind_symbol(variables, "CURRENT");
+	cycle->last_ref = bind_symbol(variables, "LAST");
+	cycle->trace_steps_ref = bind_symbol(variables, "TRACE_STEPS");
+	cycle->debug_ref = bind_symbol(variables, "DEBUG");
+	cycle->show_state_changes_ref = bind_symbol(variables, "SHOW_STATE_CHANGES");
+}
+
+int run_monitor_cycle(monitor_cycle *cycle)
+{
+	symbol_table variables = cycle->variables;
+	int method_id;
+	int next_state;
+	int method_result = 0;
+	int tracing;
+	state_info *next;
+	const char *debug_on;
+
+	next_state = check_all_conditions(variables);
+	next = find_state(next_state);
+	set_ref_integer_value(variables, cycle->time_ref, time(NULL));
+	if ( (tracing = get_ref_integer_value(variables, cycle->trace_steps_ref)) != action_tracing() )
+		set_action_tracing( tracing );
+	if (next != NULL && next != cycle->active)
+	{
+		/* change states and run the entry method */
+		if (verbose())
+			printf("next state: %s (%d)\n", next->name , next_state);
+		method_id = next->entry_method;
+		next->entries++;
+		cycle->timer_val = time(NULL);
+		set_ref_integer_value(variables, cycle->timer_ref, 0);
+		if ( get_ref_integer_value(variables, cycle->show_state_changes_ref) )
+		{
+			printf("changing state to %s\n", next->name);
+			fflush(stdout);
+		}
+		if (method_id > 0)
+			method_result = execute_method(method_id);
+		set_ref_string_value(variables, cycle->last_ref, cycle->active->name);
+		cycle->active = next;
+		set_ref_string_value(variables, cycle->current_ref, cycle->active->name);
+	}
+	else
+	{
+		/* run the poll method */
+		method_id = cycle->active->poll_method;
+		cycle->active->polls++;
+		set_ref_string_value(variables, cycle->current_ref, cycle->active->name);
+		set_ref_integer_value(variables, cycle->timer_ref, time(NULL) - cycle->timer_val);
+		if (method_id > 0)
+			method_result = execute_method(method_id);
+	}
+
+	save_variables(variables);
+
+	debug_on = get_ref_string_value(variables, cycle->debug_ref);
+	if (debug_on && strcmp(debug_on, "true") == 0)
+		set_verbose(1);
+	else if (debug_on && strcmp(debug_on, "false") == 0)
+		set_verbose(0);
+	return method_result;
+}
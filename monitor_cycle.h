@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __MONITOR_CYCLE_H__
+#define __MONITOR_CYCLE_H__
+
+#include <time.h>
+#include "symboltable.h"
+#include "state_registry.h"
+
+/* One pass of the monitor's main loop: check the conditions, change state 
+   or poll the current state, and save the persistent variables. The caller 
+   decides how long to wait between cycles.
+ */
+
+typedef struct monitor_cycle
+{
+	symbol_table variables;
+	state_info *active; /* the current state */
+	time_t timer_val; /* when the current state was entered */
+	symbol_ref time_ref;
+	symbol_ref timer_ref;
+	symbol_ref current_ref;
+	symbol_ref last_ref;
+	symbol_ref trace_steps_ref;
+	symbol_ref debug_ref;
+	symbol_ref show_state_changes_ref;
+} monitor_cycle;
+
+/* bind the variables the cycle updates and start in the given state. The 
+   conditions and methods should already be bound.
+ */
+void init_monitor_cycle(monitor_cycle *cycle, symbol_table variables, int start_state);
+
+/* returns the result of the entry or poll method that was run, -1 asks 
+   the monitor to stop
+ */
+int run_monitor_cycle(monitor_cycle *cycle);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "numbers.h"
+
+int parse_integer(const char *string, int *value)
+{
+	const char *p = string;
+	unsigned int result = 0;
+	int negative = 0;
+	if (p == NULL)
+		return 0;
+	if (*p == '-')
+	{
+		negative = 1;
+		p++;
+	}
+	if (*p < '0' || *p > '9')
+		return 0;
+	while (*p >= '0' && *p <= '9')
+		result = result * 10 + (*p++ - '0'); /* wraps like atoi() on overflow */
+	if (*p != 0)
+		return 0;
+	if (value)
+		*value = (negative) ? (int)(0U - result) : (int)result;
+	return 1;
+}
+
+int parse_boolean(const char *string, int default_value)
+{
+	int value;
+	if (string == NULL)
+		return default_value;
+	if (parse_integer(string, &value))
+		return value != 0;
+	if (strcmp(string, "YES") == 0 || strcmp(string, "TRUE") == 0)
+		return 1;
+	if (strcmp(string, "NO") == 0 || strcmp(string, "FALSE") == 0)
+		return 0;
+	return default_value;
+}
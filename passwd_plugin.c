@@ -98,6 +98,9 @@ static int writePasswordToFile(struct passwd*pwe,char*encrypted_password,FILE*pw
  */
 
 
+static const char *plugin_properties[] = { "MAXBUFSIZE" };
+static property_key_set plugin_keys = PROPERTY_KEY_SET(plugin_properties);
+
 #ifdef BUILD_PLUGIN
 EXPORT
 #else
@@ -126,7 +129,7 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
   
   if (!buf) {
     if (!buflen)
-      buflen = lookup_int_property(variables, argv[0], "MAXBUFSIZE", 5000);
+      buflen = lookup_key_int(group_keys(&plugin_keys, variables, argv[0])[0], 5000);
     buf = malloc(buflen);
     if (!buf) ABORT; /* no memory? */
   }
@@ -530,6 +533,7 @@ int main (int argc, const char * argv[]) {
 	if (buf) printf("result: %s\n", buf);
     printf("symbols:\n");
     dump_symbol_table(variables);
+    release_table_property_keys(variables);
     free_symbol_table(variables);
     fflush(stdout);
     return 0;
@@ -27,12 +27,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <dlfcn.h>
 #include <signal.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "symboltable.h"
 #include "splitstring.h"
 #include "property.h"
 #include "options.h"
 #include "plugin.h"
+#include "numbers.h"
 
 /* a list used to map plugin names to handles returned from dlopen */
 
@@ -42,8 +47,11 @@ struct plugin_info
   struct plugin_info *prev;
   char *library_name;
   void *library_handle;
+  int running; /* calls on worker threads, protected by pool_lock */
 };
 
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct plugin_info *plugins = NULL;
 
 /* initialise the plugin list. Must be called before other routines are used */
@@ -65,6 +73,7 @@ struct plugin_info *create_plugin_record(const char *library_name, void *library
     result->prev = NULL;
     result->library_name = strdup(library_name);
     result->library_handle = library_handle;
+    result->running = 0;
     if (!plugins)
       plugins = result;
     else
@@ -104,22 +113,190 @@ void remove_plugin_record(const char *library_name)
   }
 }
 
+/* plugin descriptors, one for each property group that has been used as a plugin */
+
+static plugin_descriptor *descriptors = NULL;
+
+static plugin_descriptor *find_descriptor(symbol_table variables, const char *property_group)
+{
+  plugin_descriptor *pd = descriptors;
+  while (pd && (pd->variables != variables || strcmp(pd->group, property_group) != 0))
+    pd = pd->next;
+  return pd;
+}
+
+/* descriptors that used a library that has been closed must open it again */
+static void forget_library(void *library_handle)
+{
+  plugin_descriptor *pd;
+  for (pd = descriptors; pd; pd = pd->next)
+    if (pd->library_handle == library_handle)
+    {
+      pd->library_handle = NULL;
+      pd->func = NULL;
+    }
+}
+
+/* called when one of the variables of a descriptor changes */
+static void update_descriptor(symbol_table variables, symbol_ref ref, void *user_data)
+{
+  plugin_descriptor *pd = (plugin_descriptor *)user_data;
+  const char *library_name = NULL;
+  const char *retain = NULL;
+  const char *cache = NULL;
+  const char *parallel = NULL;
+  lookup_ref_string_value(variables, pd->library_ref, &library_name);
+  if (!library_name || !pd->library_name || strcmp(library_name, pd->library_name) != 0)
+  {
+    /* an open library stays in the plugin list and is found again by name */
+    free(pd->library_name);
+    pd->library_name = (library_name) ? strdup(library_name) : NULL;
+    pd->library_handle = NULL;
+    pd->func = NULL;
+  }
+  lookup_ref_string_value(variables, pd->retain_ref, &retain);
+  pd->retain = (!retain || strcmp(retain, "YES") == 0 || strcmp(retain, "TRUE") == 0);
+  pd->maxbufsize = 0;
+  lookup_ref_integer_value(variables, pd->maxbufsize_ref, &pd->maxbufsize);
+  pd->timeout = 5;
+  lookup_ref_integer_value(variables, pd->timeout_ref, &pd->timeout);
+  lookup_ref_string_value(variables, pd->cache_ref, &cache);
+  pd->cache_results = parse_boolean(cache, 1);
+  lookup_ref_string_value(variables, pd->parallel_ref, &parallel);
+  pd->parallel = parse_boolean(parallel, 0);
+}
+
+static symbol_ref bind_property(symbol_table variables, const char *property_group, const char *property)
+{
+  symbol_ref ref;
+  char *name = malloc(strlen(property_group) + strlen(property) + 2);
+  sprintf(name, "%s_%s", property_group, property);
+  ref = bind_symbol(variables, name);
+  free(name);
+  return ref;
+}
+
+plugin_descriptor *describe_plugin(symbol_table variables, const char *property_group)
+{
+  plugin_descriptor *pd = find_descriptor(variables, property_group);
+  if (pd)
+    return pd;
+  pd = malloc(sizeof(plugin_descriptor));
+  if (!pd)
+  {
+    fprintf(stderr, "Unable to allocate plugin descriptor\n");
+    return NULL;
+  }
+  pd->group = strdup(property_group);
+  pd->variables = variables;
+  pd->library_name = NULL;
+  pd->library_handle = NULL;
+  pd->func = NULL;
+  pd->library_ref = bind_property(variables, property_group, "LIBRARY");
+  pd->retain_ref = bind_property(variables, property_group, "RETAIN");
+  pd->maxbufsize_ref = bind_property(variables, property_group, "MAXBUFSIZE");
+  pd->timeout_ref = bind_symbol(variables, "TIMEOUT");
+  pd->cache_ref = bind_property(variables, property_group, "CACHE");
+  pd->parallel_ref = bind_property(variables, property_group, "PARALLEL");
+  update_descriptor(variables, NO_SYMBOL, pd);
+  watch_symbol(variables, pd->library_ref, update_descriptor, pd);
+  watch_symbol(variables, pd->retain_ref, update_descriptor, pd);
+  watch_symbol(variables, pd->maxbufsize_ref, update_descriptor, pd);
+  watch_symbol(variables, pd->timeout_ref, update_descriptor, pd);
+  watch_symbol(variables, pd->cache_ref, update_descriptor, pd);
+  watch_symbol(variables, pd->parallel_ref, update_descriptor, pd);
+  pd->next = descriptors;
+  descriptors = pd;
+  return pd;
+}
+
+int plugin_results_cacheable(symbol_table variables, const char *command)
+{
+  char group[64];
+  int len = 0;
+  plugin_descriptor *pd;
+  while (*command && !isspace((unsigned char)*command) && len < (int)sizeof(group) - 1)
+    group[len++] = *command++;
+  group[len] = 0;
+  pd = find_descriptor(variables, group);
+  return (pd) ? pd->cache_results : 1;
+}
+
+void release_plugin_descriptors()
+{
+  plugin_descriptor *pd = descriptors;
+  while (pd)
+  {
+    plugin_descriptor *next = pd->next;
+    unwatch_symbol(pd->variables, pd->library_ref, update_descriptor, pd);
+    unwatch_symbol(pd->variables, pd->retain_ref, update_descriptor, pd);
+    unwatch_symbol(pd->variables, pd->maxbufsize_ref, update_descriptor, pd);
+    unwatch_symbol(pd->variables, pd->timeout_ref, update_descriptor, pd);
+    unwatch_symbol(pd->variables, pd->cache_ref, update_descriptor, pd);
+    unwatch_symbol(pd->variables, pd->parallel_ref, update_descriptor, pd);
+    free(pd->group);
+    free(pd->library_name);
+    free(pd);
+    pd = next;
+  }
+  descriptors = NULL;
+}
+
 /* we can retain plugins, expecting it to improve performance at the cost of a little ram.
    These retained plugins can be released at any time, however they are likely to be retained again
    on next use.
+   A library that is still running a call abandoned on a worker thread is 
+   left open, with its record, since the worker cannot be stopped safely.
  */
+static void release_spare_copies();
+
 void release_plugins()
 {
   struct plugin_info *pii = plugins;
+  struct plugin_info *in_use = NULL;
+  pthread_mutex_lock(&pool_lock);
   while (pii)
   {
     struct plugin_info *next = pii->next;
-    free(pii->library_name);
-    dlclose(pii->library_handle);
-    free(pii);
+    forget_library(pii->library_handle);
+    if (pii->running)
+    {
+      pii->prev = NULL;
+      pii->next = in_use;
+      if (in_use)
+        in_use->prev = pii;
+      in_use = pii;
+    }
+    else
+    {
+      free(pii->library_name);
+      dlclose(pii->library_handle);
+      free(pii);
+    }
     pii = next;
   }
-  plugins = NULL;
+  plugins = in_use;
+  release_spare_copies();
+  pthread_mutex_unlock(&pool_lock);
+}
+
+/* close a library that is not to be retained */
+static void close_library(void *library_handle)
+{
+  struct plugin_info *pii = plugins;
+  while (pii && pii->library_handle != library_handle)
+    pii = pii->next;
+  forget_library(library_handle);
+  pthread_mutex_lock(&pool_lock);
+  if (pii && pii->running)
+  {
+    pthread_mutex_unlock(&pool_lock);
+    return; /* a worker is still using it */
+  }
+  pthread_mutex_unlock(&pool_lock);
+  dlclose(library_handle);
+  if (pii)
+    remove_plugin_record(pii->library_name);
 }
 
 /* we set a timer which we use to abort our plugin if necessary */
@@ -167,6 +344,63 @@ int count_params(char *argv[])
   return count;
 }
 
+static const char *library_properties[] = { "LIBRARY" };
+static property_key_set library_keys = PROPERTY_KEY_SET(library_properties);
+
+/* the descriptor of a plugin named in a command. Groups defined by a script 
+   rather than a PROPERTY block are described on first use.
+ */
+static plugin_descriptor *command_descriptor(symbol_table variables, const char *property_group)
+{
+  plugin_descriptor *pd = find_descriptor(variables, property_group);
+  if (!pd && lookup_key_string(group_keys(&library_keys, variables, property_group)[0], NULL))
+    pd = describe_plugin(variables, property_group);
+  return pd;
+}
+
+/* open the library of a descriptor, or find it among the libraries that are 
+   already open. Returns nonzero if the library was opened by this call.
+ */
+static int open_library(plugin_descriptor *pd)
+{
+  struct plugin_info *pii = find_plugin_record(pd->library_name);
+  if (pii)
+  {
+    pd->library_handle = pii->library_handle;
+    return 0;
+  }
+  pd->library_handle = dlopen(pd->library_name, RTLD_LAZY);
+  if (pd->library_handle)
+    create_plugin_record(pd->library_name, pd->library_handle);
+  return 1;
+}
+
+/* set RESULT from what a plugin function returned. buf is the buffer the 
+   plugin was given; other data belongs to the plugin and is handed over.
+ */
+static int publish_result(symbol_table variables, const char *command, char *data, char *buf)
+{
+  if (verbose() && data)
+  {
+    printf("result of %s: %s\n", command, data);
+  }
+  if (data)
+  {
+    if (data != buf)
+    {
+      /* the plugin allocated the result, hand it over rather than copying it */
+      shared_value value = adopt_shared_value(data);
+      set_shared_value(variables, "RESULT", value);
+      release_shared_value(value);
+    }
+    else
+      set_string_value(variables, "RESULT", data);
+    return PLUGIN_COMPLETED;
+  }
+  set_string_value(variables, "RESULT", "");
+  return PLUGIN_ERROR;
+}
+
 int plugin(symbol_table variables, const char *command, const char **params)
 {
   int result = 0;
@@ -182,49 +416,38 @@ int plugin(symbol_table variables, const char *command, const char **params)
     parameters = split_string(command);
   if (parameters != NULL)
   {
-    void *mylib_handle = NULL;
-    const char *library_name;
-    const char *property_group = parameters[0];
-    plugin_function func;
-
-    library_name = lookup_string_property(variables, property_group, "LIBRARY", NULL);
-    if (library_name)
+    plugin_descriptor *pd = command_descriptor(variables, parameters[0]);
+    if (pd && pd->library_name)
     {
-      const char *retain;
-      struct plugin_info *pii = find_plugin_record(library_name);
-      if (!pii)
+      int retain = 1;
+      if (!pd->library_handle && open_library(pd))
+        retain = pd->retain;
+      if (pd->library_handle == NULL)
       {
-        retain = lookup_string_property(variables, property_group, "RETAIN", "YES");
-        mylib_handle = dlopen(library_name, RTLD_LAZY);
-        if (mylib_handle)
-          pii = create_plugin_record(library_name, mylib_handle);
+        fprintf(stderr, "unable to open library %s: %s\n", pd->library_name, dlerror());
       }
       else
       {
-        retain = "YES";
-        mylib_handle = pii->library_handle;
-      }
-      if (mylib_handle == NULL)
-      {
-        fprintf(stderr, "unable to open library %s: %s\n", library_name, dlerror());
-      }
-      else
-      {
-        int buflen = lookup_int_property(variables, property_group, "MAXBUFSIZE", 0);
+        /* the plugin may change the descriptor's variables, so keep what we need */
+        void *mylib_handle = pd->library_handle;
+        int buflen = pd->maxbufsize;
         char *buf = NULL;
+        plugin_function func;
         remove_properties(variables, "RESULT");
         if (buflen)
           buf = malloc(buflen);
-        dlerror(); /* reset errors */
-        func = dlsym((void *)mylib_handle, "plugin_func");
+        if (!pd->func)
+        {
+          dlerror(); /* reset errors */
+          pd->func = dlsym((void *)mylib_handle, "plugin_func");
+        }
+        func = pd->func;
         if (func)
         {
           sig_t saved_alarm_sig = NULL;
           char *data;
 
-          int timeout_secs = get_integer_value(variables, "TIMEOUT");
-          if (!found_key(variables))
-            timeout_secs = 5;
+          int timeout_secs = pd->timeout;
           if ( timeout_secs == 0)
           {
             saved_alarm_sig = signal(SIGALRM, SIG_DFL);
@@ -247,41 +470,25 @@ int plugin(symbol_table variables, const char *command, const char **params)
             timeout_message = NULL;
             free(msg);
           }
-          if (verbose() && data)
-          {
-            printf("result of %s: %s\n", command, data);
-          }
-          if (data)
-          {
-            set_string_value(variables, "RESULT", data);
-            if (data != buf)
-              free(data);
-            result = PLUGIN_COMPLETED;
-          }
-          else
-          {
-            set_string_value(variables, "RESULT", "");
-            result = PLUGIN_ERROR;
-          }
+          result = publish_result(variables, command, data, buf);
         }
         else
         {
           const char *template = "unable to find symbol 'plugin_func' in library.\n%s\n";
           char *message;
           const char *errtext = dlerror();
-          message = malloc(strlen(template) + strlen(library_name) + strlen(errtext));
-          sprintf(message, template, library_name, errtext);
-          fprintf(stderr, message, template, library_name, errtext);
+          if (!errtext)
+            errtext = "";
+          message = malloc(strlen(template) + strlen(pd->library_name) + strlen(errtext));
+          sprintf(message, template, pd->library_name, errtext);
+          fprintf(stderr, "%s", message);
 
           set_string_value(variables, "RESULT", message);
           free(message);
           result = PLUGIN_ERROR;
         }
-        if (!retain || (strcmp(retain, "YES") != 0 && strcmp(retain, "TRUE") != 0) )
-        {
-          dlclose(mylib_handle);
-          remove_plugin_record(library_name);
-        }
+        if (!retain)
+          close_library(mylib_handle);
         if (buf)
           free(buf);
       }
@@ -293,3 +500,267 @@ int plugin(symbol_table variables, const char *command, const char **params)
   }
   return result;
 }
+
+/* 
+   Plugin calls may be handed to a small pool of worker threads so that 
+   slow calls (eg network probes) overlap. Workers are started as calls are
+   queued, up to MAX_PLUGIN_WORKERS, and then wait for more work. A thread 
+   cannot be interrupted safely, so rather than the alarm used by plugin()
+   the caller waits for a call until its deadline and then abandons it; the 
+   worker discards the result when the plugin eventually returns, and exits.
+   An abandoned worker no longer counts towards MAX_PLUGIN_WORKERS, so hung
+   plugins cannot use up the pool.
+
+   Each call is given its own private copy of the variables, so calls cannot 
+   see each other's RESULT_ properties and the caller's table is never used
+   by a worker. When the call finishes, the symbols the plugin changed are 
+   merged back. The copies are kept for reuse so that the property keys a 
+   plugin holds for them stay valid.
+ */
+
+#define MAX_PLUGIN_WORKERS 8
+
+struct plugin_call
+{
+  struct plugin_call *next; /* the next call waiting for a worker */
+  symbol_table variables;
+  symbol_table copy; /* what the plugin is given instead of variables */
+  struct plugin_info *library; /* kept open while the call runs */
+  plugin_function func;
+  char *command;
+  char **parameters;
+  char *buf;
+  int buflen;
+  char *data; /* what the plugin function returned */
+  int timeout; /* seconds, 0 to wait for as long as it takes */
+  struct timespec deadline;
+  int finished;
+  int abandoned; /* the caller has stopped waiting, the worker releases the call */
+};
+
+static pthread_cond_t work_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_finished = PTHREAD_COND_INITIALIZER;
+static plugin_call *work_queue = NULL;
+static plugin_call *work_queue_tail = NULL;
+static int num_queued = 0;
+static int num_workers = 0;
+static int idle_workers = 0;
+static symbol_table *spare_copies = NULL;
+static int num_spare_copies = 0;
+static int spare_copies_size = 0;
+
+/* a copy of the variables for a call. Called with pool_lock held */
+static symbol_table take_copy(symbol_table variables)
+{
+  symbol_table copy;
+  if (num_spare_copies == 0)
+    return copy_symbol_table(variables);
+  copy = spare_copies[--num_spare_copies];
+  refresh_copy(copy, variables);
+  return copy;
+}
+
+/* keep a copy for another call. Called with pool_lock held */
+static void spare_copy(symbol_table copy)
+{
+  if (num_spare_copies == spare_copies_size)
+  {
+    spare_copies_size = (spare_copies_size) ? spare_copies_size * 2 : MAX_PLUGIN_WORKERS;
+    spare_copies = realloc(spare_copies, spare_copies_size * sizeof(symbol_table));
+  }
+  spare_copies[num_spare_copies++] = copy;
+}
+
+/* Called with pool_lock held */
+static void release_spare_copies()
+{
+  while (num_spare_copies)
+  {
+    symbol_table copy = spare_copies[--num_spare_copies];
+    release_table_property_keys(copy);
+    free_symbol_table(copy);
+  }
+  free(spare_copies);
+  spare_copies = NULL;
+  spare_copies_size = 0;
+}
+
+/* Called with pool_lock held */
+static void free_plugin_call(plugin_call *call)
+{
+  if (call->data && call->data != call->buf)
+    free(call->data);
+  if (call->library)
+    call->library->running--;
+  spare_copy(call->copy);
+  free(call->buf);
+  free(call->command);
+  release_params(call->parameters);
+  free(call);
+}
+
+/* take a call off the queue, nonzero if it was there. Called with pool_lock held */
+static int dequeue_call(plugin_call *call)
+{
+  plugin_call **prev = &work_queue;
+  plugin_call *last = NULL;
+  while (*prev && *prev != call)
+  {
+    last = *prev;
+    prev = &(*prev)->next;
+  }
+  if (!*prev)
+    return 0;
+  *prev = call->next;
+  if (work_queue_tail == call)
+    work_queue_tail = last;
+  num_queued--;
+  return 1;
+}
+
+static void *plugin_worker(void *unused)
+{
+  pthread_mutex_lock(&pool_lock);
+  for (;;)
+  {
+    plugin_call *call;
+    while (!work_queue)
+    {
+      idle_workers++;
+      pthread_cond_wait(&work_queued, &pool_lock);
+      idle_workers--;
+    }
+    call = work_queue;
+    dequeue_call(call);
+    pthread_mutex_unlock(&pool_lock);
+
+    call->data = call->func(call->copy, call->buf, call->buflen, 
+        count_params(call->parameters), call->parameters);
+
+    pthread_mutex_lock(&pool_lock);
+    if (call->abandoned)
+    {
+      /* the pool has stopped counting this worker, so it leaves */
+      free_plugin_call(call);
+      pthread_mutex_unlock(&pool_lock);
+      return NULL;
+    }
+    else
+    {
+      call->finished = 1;
+      pthread_cond_broadcast(&work_finished);
+    }
+  }
+  return NULL;
+}
+
+plugin_call *start_plugin_call(symbol_table variables, const char *command)
+{
+  char **parameters = split_string(command);
+  plugin_descriptor *pd;
+  plugin_call *call;
+  pthread_t worker;
+  if (parameters == NULL)
+    return NULL;
+  pd = command_descriptor(variables, parameters[0]);
+  /* the library of a parallel plugin must stay open while the workers use it */
+  if (pd && pd->parallel && pd->retain && pd->library_name && !pd->library_handle)
+    open_library(pd);
+  if (!pd || !pd->parallel || !pd->retain || !pd->library_handle)
+  {
+    release_params(parameters);
+    return NULL;
+  }
+  if (!pd->func)
+  {
+    /* ISO C has no conversion from void * to a function pointer */
+    union { void *symbol; plugin_function func; } found;
+    dlerror(); /* reset errors */
+    found.symbol = dlsym(pd->library_handle, "plugin_func");
+    pd->func = found.func;
+    if (!pd->func)
+    {
+      /* let plugin() report the problem */
+      release_params(parameters);
+      return NULL;
+    }
+  }
+  /* as plugin() does, the call starts without the RESULT_ properties of earlier calls */
+  remove_properties(variables, "RESULT");
+  call = malloc(sizeof(plugin_call));
+  call->next = NULL;
+  call->variables = variables;
+  call->library = find_plugin_record(pd->library_name);
+  call->func = pd->func;
+  call->command = strdup(command);
+  call->parameters = parameters;
+  call->buflen = pd->maxbufsize;
+  call->buf = (call->buflen) ? malloc(call->buflen) : NULL;
+  call->data = NULL;
+  call->timeout = pd->timeout;
+  clock_gettime(CLOCK_REALTIME, &call->deadline);
+  call->deadline.tv_sec += call->timeout;
+  call->finished = 0;
+  call->abandoned = 0;
+
+  pthread_mutex_lock(&pool_lock);
+  call->copy = take_copy(variables);
+  if (call->library)
+    call->library->running++;
+  if (work_queue_tail)
+    work_queue_tail->next = call;
+  else
+    work_queue = call;
+  work_queue_tail = call;
+  num_queued++;
+  if (num_queued > idle_workers && num_workers < MAX_PLUGIN_WORKERS 
+      && pthread_create(&worker, NULL, plugin_worker, NULL) == 0)
+  {
+    pthread_detach(worker);
+    num_workers++;
+  }
+  pthread_cond_signal(&work_queued);
+  pthread_mutex_unlock(&pool_lock);
+  return call;
+}
+
+int finish_plugin_call(plugin_call *call)
+{
+  symbol_table variables = call->variables;
+  int result;
+  pthread_mutex_lock(&pool_lock);
+  while (!call->finished)
+  {
+    if (call->timeout == 0)
+      pthread_cond_wait(&work_finished, &pool_lock);
+    else if (pthread_cond_timedwait(&work_finished, &pool_lock, &call->deadline) == ETIMEDOUT)
+      break;
+  }
+  /* calls finished earlier may have left their RESULT_ properties */
+  remove_properties(variables, "RESULT");
+  if (!call->finished)
+  {
+    /* reported now, the call may be released as soon as it is let go */
+    fprintf(stderr, "Plugin timeout (%d sec) running %s. Abandoned.\n", call->timeout, call->command);
+    if (dequeue_call(call))
+      free_plugin_call(call);
+    else
+    {
+      /* the worker is stuck in the plugin, another may be started in its place */
+      call->abandoned = 1;
+      num_workers--;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    set_string_value(variables, "RESULT", "");
+    return PLUGIN_ERROR;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  merge_copy(variables, call->copy);
+  result = publish_result(variables, call->command, call->data, call->buf);
+  if (call->data != call->buf)
+    call->data = NULL; /* now owned by RESULT */
+  pthread_mutex_lock(&pool_lock);
+  free_plugin_call(call);
+  pthread_mutex_unlock(&pool_lock);
+  return result;
+}
@@ -33,10 +33,61 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 typedef char *(*plugin_function)(symbol_table , char *, int , int , char **);
 
+/* a plugin descriptor holds the settings of a PROPERTY group that plugin()
+   needs, kept up to date by watching the group's variables so that calling
+   the plugin does not involve looking them up.
+ */
+typedef struct plugin_descriptor
+{
+  struct plugin_descriptor *next;
+  char *group;
+  symbol_table variables;
+  char *library_name; /* group_LIBRARY, NULL if it is not defined */
+  void *library_handle; /* NULL until the library has been opened */
+  plugin_function func; /* NULL until looked up in the library */
+  int retain; /* group_RETAIN, default YES */
+  int maxbufsize; /* group_MAXBUFSIZE, default 0 */
+  int timeout; /* the TIMEOUT variable, default 5 seconds */
+  int cache_results; /* group_CACHE, default YES. NO for plugins with side effects */
+  int parallel; /* group_PARALLEL, default NO. YES for plugins that may run on several threads at once */
+  symbol_ref library_ref;
+  symbol_ref retain_ref;
+  symbol_ref maxbufsize_ref;
+  symbol_ref timeout_ref;
+  symbol_ref cache_ref;
+  symbol_ref parallel_ref;
+} plugin_descriptor;
+
 void init_plugins();
 
+/* returns the descriptor of a property group, creating it if necessary */
+plugin_descriptor *describe_plugin(symbol_table variables, const char *property_group);
+
 int plugin(symbol_table variables, const char *command, const char **params);
 
+/* nonzero if the result of the command may be reused within a cycle; 
+   this is the CACHE property of the plugin named by the first word. */
+int plugin_results_cacheable(symbol_table variables, const char *command);
+
+/* 
+   a plugin call running on a worker thread. Only plugins with PARALLEL set 
+   are run this way. The plugin is given a private copy of the variables 
+   (see copy_symbol_table()) as they were when the call was started, and 
+   the symbols it changes, such as its RESULT_ properties, are merged back 
+   when the call is finished.
+ */
+typedef struct plugin_call plugin_call;
+
+/* start running the command on a worker thread. Returns NULL if the plugin
+   is not to be run in parallel, in which case use plugin() instead. */
+plugin_call *start_plugin_call(symbol_table variables, const char *command);
+
+/* wait for the call to finish, or for its TIMEOUT to pass, and set RESULT 
+   as plugin() would. The call is released. */
+int finish_plugin_call(plugin_call *call);
+
 void release_plugins(); /* call to close and free memory from all plugins */
 
+void release_plugin_descriptors(); /* stop watching and free all descriptors */
+
 #endif
@@ -24,18 +24,53 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "symboltable.h"
 #include "options.h"
 #include "property.h"
-#include "regular_expressions.h"
+#include "numbers.h"
+
+/* the prefix shared by all properties of a group. Short group names use the 
+   caller's buffer to save allocating memory.
+ */
+static char *group_prefix(const char *property_group, char *buf, int buflen)
+{
+	char *result = buf;
+	int len = strlen(property_group) + 2;
+	if (len > buflen)
+		result = malloc(len);
+	sprintf(result, "%s_", property_group);
+	return result;
+}
+
+#define PREFIX_BUFSIZE 64
+
+static void copy_symbol(const char *name, const char *value, void *user_data)
+{
+	set_string_value((symbol_table)user_data, name, value);
+}
 
 symbol_table collect_properties(symbol_table symbols, const char *property_group)
 {
-	symbol_table result;
-	char *tmp_str = malloc(strlen(property_group) + 3);
-	sprintf(tmp_str, "^%s_", property_group);
-	result = collect_matching(symbols, tmp_str);
-    free(tmp_str);
+	symbol_table result = init_symbol_table();
+	char buf[PREFIX_BUFSIZE];
+	char *prefix = group_prefix(property_group, buf, PREFIX_BUFSIZE);
+	each_symbol_with_prefix(symbols, prefix, copy_symbol, result);
+	if (prefix != buf)
+		free(prefix);
+	return result;
+}
+
+/* the full name of a property. As with group_prefix, short names use the 
+   caller's buffer.
+ */
+static char *property_name(const char *property_group, const char *property, char *buf, int buflen)
+{
+	char *result = buf;
+	int len = strlen(property_group) + strlen(property) + 2;
+	if (len > buflen)
+		result = malloc(len);
+	sprintf(result, "%s_%s", property_group, property);
 	return result;
 }
 
@@ -43,16 +78,17 @@ const char *lookup_string_property(symbol_table variables,
 		const char *property_group, const char *property, const char *default_value)
 {
 	const char *value;
-    char *tmp_str;
-    if (!property) return default_value;
-    if (property_group == NULL)
-        property_group = "";
-	tmp_str = malloc(strlen(property_group) + strlen(property) + 2);
-	sprintf(tmp_str, "%s_%s", property_group, property);
-	value = get_string_value(variables, tmp_str);
+	char buf[PREFIX_BUFSIZE];
+	char *name;
+	if (!property) return default_value;
+	if (property_group == NULL)
+		property_group = "";
+	name = property_name(property_group, property, buf, PREFIX_BUFSIZE);
+	value = get_string_value(variables, name);
 	if (value == NULL)
 		value = default_value;
-	free(tmp_str);
+	if (name != buf)
+		free(name);
 	
 	return value;
 }
@@ -60,58 +96,289 @@ const char *lookup_string_property(symbol_table variables,
 int lookup_int_property(symbol_table variables, const char *property_group, const char *property, int default_value)
 {
 	int value;
-	char *tmp_str = malloc(strlen(property_group) + strlen(property) + 2);
-	sprintf(tmp_str, "%s_%s", property_group, property);
+	char buf[PREFIX_BUFSIZE];
+	char *name = property_name(property_group, property, buf, PREFIX_BUFSIZE);
 	if (verbose())
-		printf("looking for property: %s\n", tmp_str);
-	value = get_integer_value(variables, tmp_str);
-	if (!found_key(variables))
-		value = default_value;
-	free(tmp_str);
+		printf("looking for property: %s\n", name);
+	value = default_value;
+	lookup_integer_value(variables, name, &value);
+	if (name != buf)
+		free(name);
 	return value;
 }
 
 int lookup_boolean_property(symbol_table variables, 
 		const char *property_group, const char *property, int default_value)
 {
-	const char *value;
-	int result = default_value;
-	char *tmp_str = malloc(strlen(property_group) + strlen(property) + 2);
-	sprintf(tmp_str, "%s_%s", property_group, property);
+	int result;
+	char buf[PREFIX_BUFSIZE];
+	char *name = property_name(property_group, property, buf, PREFIX_BUFSIZE);
 	if (verbose())
-		printf("looking for property: %s\n", tmp_str);
-	value = get_string_value(variables, tmp_str);
-	if (value)
-	{
-		if (is_integer(value))
-			result = atoi(value) != 0;
-		else if (strcmp(value, "YES") == 0 || strcmp(value, "TRUE") == 0)
-			result = 1;
-		else if (strcmp(value, "NO") == 0 || strcmp(value, "FALSE") == 0)
-			result = 0;
-	}
-	free(tmp_str);
+		printf("looking for property: %s\n", name);
+	result = parse_boolean(get_string_value(variables, name), default_value);
+	if (name != buf)
+		free(name);
 	return result;
 }
 
 void set_int_property(symbol_table variables, const char *property_group, const char *property, int value)
 {
-	char *tmp_str = malloc(strlen(property_group) + strlen(property) + 2);
-	sprintf(tmp_str, "%s_%s", property_group, property);
+	char buf[PREFIX_BUFSIZE];
+	char *name = property_name(property_group, property, buf, PREFIX_BUFSIZE);
 	if (verbose())
-		printf("setting  property: %s to %d\n", tmp_str, value);
-	set_integer_value(variables, tmp_str, value);
-	free(tmp_str);
+		printf("setting  property: %s to %d\n", name, value);
+	set_integer_value(variables, name, value);
+	if (name != buf)
+		free(name);
 }
 
 void set_string_property(symbol_table variables, const char *property_group, const char *property, const char *value)
 {
-	char *tmp_str = malloc(strlen(property_group) + strlen(property) + 2);
-	sprintf(tmp_str, "%s_%s", property_group, property);
+	char buf[PREFIX_BUFSIZE];
+	char *name = property_name(property_group, property, buf, PREFIX_BUFSIZE);
 	if (verbose())
-		printf("setting  property: %s to %s\n", tmp_str, value);
-	set_string_value(variables, tmp_str, value);
-	free(tmp_str);
+		printf("setting  property: %s to %s\n", name, value);
+	set_string_value(variables, name, value);
+	if (name != buf)
+		free(name);
+}
+
+/* property keys are kept in a small hash table indexed by table, group and
+   property so that finding the key for a property does not allocate.
+   Plugins running on worker threads may look up keys at the same time.
+ */
+
+struct property_key_internal
+{
+	struct property_key_internal *next;
+	symbol_table st;
+	char *group;
+	char *property;
+	unsigned int hash;
+	symbol_ref ref;
+	unsigned int binding; /* the binding generation of the table when ref was bound */
+};
+
+#define KEY_BUCKETS 256
+
+static property_key key_buckets[KEY_BUCKETS];
+static pthread_mutex_t key_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int key_hash(symbol_table st, const char *property_group, const char *property)
+{
+	unsigned int h = 2166136261U ^ (unsigned int)(unsigned long)st;
+	const unsigned char *p;
+	for (p = (const unsigned char *)property_group; *p; p++)
+		h = (h ^ *p) * 16777619U;
+	h = (h ^ '_') * 16777619U;
+	for (p = (const unsigned char *)property; *p; p++)
+		h = (h ^ *p) * 16777619U;
+	return h;
+}
+
+property_key property_key_for(symbol_table st, const char *property_group, const char *property)
+{
+	unsigned int h;
+	property_key key;
+	char buf[PREFIX_BUFSIZE];
+	char *name;
+	if (property_group == NULL)
+		property_group = "";
+	h = key_hash(st, property_group, property);
+	pthread_mutex_lock(&key_lock);
+	for (key = key_buckets[h % KEY_BUCKETS]; key; key = key->next)
+		if (key->hash == h && key->st == st && strcmp(key->property, property) == 0 
+				&& strcmp(key->group, property_group) == 0)
+		{
+			pthread_mutex_unlock(&key_lock);
+			return key;
+		}
+	key = malloc(sizeof(struct property_key_internal));
+	if (!key)
+	{
+		pthread_mutex_unlock(&key_lock);
+		return NULL;
+	}
+	name = property_name(property_group, property, buf, PREFIX_BUFSIZE);
+	key->st = st;
+	key->group = strdup(property_group);
+	key->property = strdup(property);
+	key->hash = h;
+	key->ref = bind_symbol(st, name);
+	key->binding = binding_generation(st);
+	key->next = key_buckets[h % KEY_BUCKETS];
+	key_buckets[h % KEY_BUCKETS] = key;
+	pthread_mutex_unlock(&key_lock);
+	if (name != buf)
+		free(name);
+	return key;
+}
+
+/* the symbol of a key. The references of a private copy change when it is 
+   refreshed; only the thread using the copy uses its keys, so the key can 
+   simply be bound again.
+ */
+static symbol_ref key_ref(property_key key)
+{
+	unsigned int binding = binding_generation(key->st);
+	if (key->binding != binding)
+	{
+		char buf[PREFIX_BUFSIZE];
+		char *name = property_name(key->group, key->property, buf, PREFIX_BUFSIZE);
+		key->ref = bind_symbol(key->st, name);
+		key->binding = binding;
+		if (name != buf)
+			free(name);
+	}
+	return key->ref;
+}
+
+const char *lookup_key_string(property_key key, const char *default_value)
+{
+	const char *value = key ? get_ref_string_value(key->st, key_ref(key)) : NULL;
+	return value ? value : default_value;
+}
+
+int lookup_key_int(property_key key, int default_value)
+{
+	int value = default_value;
+	if (key)
+		lookup_ref_integer_value(key->st, key_ref(key), &value);
+	return value;
+}
+
+int lookup_key_boolean(property_key key, int default_value)
+{
+	if (!key)
+		return default_value;
+	return parse_boolean(get_ref_string_value(key->st, key_ref(key)), default_value);
+}
+
+void set_key_int(property_key key, int value)
+{
+	if (key)
+		set_ref_integer_value(key->st, key_ref(key), value);
+}
+
+void set_key_string(property_key key, const char *value)
+{
+	if (key)
+		set_ref_string_value(key->st, key_ref(key), value);
+}
+
+struct group_keys
+{
+	struct group_keys *next;
+	symbol_table st;
+	char *group;
+	property_key keys[1];
+};
+
+/* the sets that hold any groups, so that their keys can be released */
+static property_key_set *key_sets = NULL;
+
+property_key *group_keys(property_key_set *set, symbol_table st, const char *property_group)
+{
+	struct group_keys *g;
+	int i;
+	if (property_group == NULL)
+		property_group = "";
+	/* groups are only added at the head of the list, so finding one needs no 
+	   lock. The acquire pairs with the release that publishes a group. */
+	for (g = __atomic_load_n(&set->groups, __ATOMIC_ACQUIRE); g; g = g->next)
+		if (g->st == st && strcmp(g->group, property_group) == 0)
+			return g->keys;
+	g = malloc(sizeof(struct group_keys) + (set->count - 1) * sizeof(property_key));
+	g->st = st;
+	g->group = strdup(property_group);
+	for (i = 0; i < set->count; i++)
+		g->keys[i] = property_key_for(st, property_group, set->properties[i]);
+	pthread_mutex_lock(&key_lock);
+	if (!set->listed)
+	{
+		set->next_set = key_sets;
+		key_sets = set;
+		set->listed = 1;
+	}
+	g->next = set->groups;
+	__atomic_store_n(&set->groups, g, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&key_lock);
+	return g->keys;
+}
+
+static void release_groups(symbol_table st)
+{
+	property_key_set *set;
+	for (set = key_sets; set; set = set->next_set)
+	{
+		struct group_keys **link = &set->groups;
+		while (*link)
+		{
+			struct group_keys *g = *link;
+			if (st && g->st != st)
+			{
+				link = &g->next;
+				continue;
+			}
+			*link = g->next;
+			free(g->group);
+			free(g);
+		}
+	}
+}
+
+static void release_key(property_key key)
+{
+	free(key->group);
+	free(key->property);
+	free(key);
+}
+
+void release_table_property_keys(symbol_table st)
+{
+	int i;
+	pthread_mutex_lock(&key_lock);
+	release_groups(st);
+	for (i = 0; i < KEY_BUCKETS; i++)
+	{
+		property_key *link = &key_buckets[i];
+		while (*link)
+		{
+			property_key key = *link;
+			if (key->st != st)
+			{
+				link = &key->next;
+				continue;
+			}
+			*link = key->next;
+			release_key(key);
+		}
+	}
+	pthread_mutex_unlock(&key_lock);
+}
+
+void release_property_keys()
+{
+	int i;
+	pthread_mutex_lock(&key_lock);
+	release_groups(NULL);
+	while (key_sets)
+	{
+		key_sets->listed = 0;
+		key_sets = key_sets->next_set;
+	}
+	for (i = 0; i < KEY_BUCKETS; i++)
+	{
+		property_key key = key_buckets[i];
+		while (key)
+		{
+			property_key next = key->next;
+			release_key(key);
+			key = next;
+		}
+		key_buckets[i] = NULL;
+	}
+	pthread_mutex_unlock(&key_lock);
 }
 
 struct iterator_data
@@ -131,23 +398,94 @@ void property_handler(const char *name, const char *value, void *user_data)
 void each_property(symbol_table st, const char *property_group, property_func f, void *user_data)
 {
 	struct iterator_data data;
-	symbol_table properties;
-	char *tmp_str = malloc(strlen(property_group) + 3);
-	sprintf(tmp_str, "^%s_", property_group);
-	properties = collect_matching(st, tmp_str);
+	char buf[PREFIX_BUFSIZE];
+	char *prefix = group_prefix(property_group, buf, PREFIX_BUFSIZE);
 	data.group = property_group;
 	data.user = user_data;
 	data.func = f;
-	each_symbol(properties, property_handler, &data);
-	free_symbol_table(properties);
-	free(tmp_str);
+	each_symbol_with_prefix(st, prefix, property_handler, &data);
+	if (prefix != buf)
+		free(prefix);
 }
 
 void remove_properties(symbol_table st, const char *property_group)
 {
-	char *tmp_str = malloc(strlen(property_group) + 3);
-	sprintf(tmp_str, "^%s_", property_group);
-	remove_matching(st, tmp_str);
+	char buf[PREFIX_BUFSIZE];
+	char *prefix = group_prefix(property_group, buf, PREFIX_BUFSIZE);
+	remove_symbols_with_prefix(st, prefix);
 	remove_symbol(st, property_group);
-	free(tmp_str);
+	if (prefix != buf)
+		free(prefix);
+}
+
+/* split text of the form  key separator value terminator ... into properties of 
+   the result group. All the fields are added to the symbol table in one step.
+ */
+void interpret_properties(symbol_table variables, const char *result_group, const char *text,
+		const char *field_separator, const char *field_terminator)
+{
+	const char *next = text;
+	const char *fldsep;
+	const char *fldterm;
+	int seplen = strlen(field_separator);
+	int termlen = strlen(field_terminator);
+	int grouplen = strlen(result_group);
+	int num_fields = 0;
+	int max_fields = 8;
+	const char **names;
+	const char **values;
+	int i;
+
+	/* without both markers nothing can be parsed and we would never move on */
+	if (seplen == 0 || termlen == 0 || text == NULL)
+		return;
+
+	names = malloc(max_fields * sizeof(char *));
+	values = malloc(max_fields * sizeof(char *));
+	fldsep = strstr(next, field_separator);
+	fldterm = strstr(next, field_terminator);
+	/* if there are no more field terminators, we are done */
+	while (fldterm) 
+	{
+		if (!fldsep) break;
+		
+		/* normally a field terminator wouldn't appear before the next separator
+			but this can happen if not all sections of the output are in the 
+			key-value form (eg if the response has header text)
+		 */
+		if (fldterm - next > fldsep - next)
+		{
+			int keylen = fldsep - next;
+			int valuelen = fldterm - fldsep - seplen;
+			char *name = malloc(grouplen + keylen + 2);
+			char *value = malloc(valuelen + 1);
+			sprintf(name, "%s_", result_group);
+			memmove(name + grouplen + 1, next, keylen);
+			name[grouplen + 1 + keylen] = 0;
+			memmove(value, fldsep + seplen, valuelen);
+			value[valuelen] = 0;
+			if (verbose())
+				printf("setting  property: %s to %s\n", name, value);
+			if (num_fields == max_fields)
+			{
+				max_fields *= 2;
+				names = realloc(names, max_fields * sizeof(char *));
+				values = realloc(values, max_fields * sizeof(char *));
+			}
+			names[num_fields] = name;
+			values[num_fields] = value;
+			num_fields++;
+		}
+		next = fldterm + termlen;
+		fldsep = strstr(next, field_separator);
+		fldterm = strstr(next, field_terminator);
+	}
+	set_string_values(variables, num_fields, names, values);
+	for (i=0; i<num_fields; i++)
+	{
+		free((char *)names[i]);
+		free((char *)values[i]);
+	}
+	free(names);
+	free(values);
 }
@@ -48,6 +48,52 @@ void set_int_property(symbol_table symbols, const char *property_group,
 void set_string_property(symbol_table symbols, const char *property_group, 
     const char *property, const char *value);
 
+/* a property key names one property of a group in a particular symbol table.
+   Keys are created on first use and resolved directly to the property's 
+   symbol, so code that reads the same properties on every call can avoid 
+   building their names each time. Keys remain valid until 
+   release_property_keys() is called and must not outlive their table. The 
+   keys of a private copy (see copy_symbol_table()) are bound again after 
+   the copy is refreshed.
+ */
+typedef struct property_key_internal *property_key;
+
+property_key property_key_for(symbol_table symbols, const char *property_group, 
+    const char *property);
+
+const char *lookup_key_string(property_key key, const char *default_value);
+int lookup_key_int(property_key key, int default_value);
+int lookup_key_boolean(property_key key, int default_value);
+void set_key_int(property_key key, int value);
+void set_key_string(property_key key, const char *value);
+
+/* code that reads the same properties of whichever group it is called for 
+   can list them in a static property_key_set. group_keys() returns the keys 
+   of a group in the order the properties are listed; the key table is only 
+   searched the first time a group is seen.
+ */
+typedef struct property_key_set
+{
+	const char **properties;
+	int count;
+	struct group_keys *groups;
+	struct property_key_set *next_set;
+	int listed;
+} property_key_set;
+
+#define PROPERTY_KEY_SET(properties) \
+	{ properties, sizeof(properties) / sizeof(properties[0]), NULL, NULL, 0 }
+
+property_key *group_keys(property_key_set *set, symbol_table symbols, 
+    const char *property_group);
+
+/* forget the keys of a table. Call this before freeing a table that had keys, 
+   while no other thread is looking up keys.
+ */
+void release_table_property_keys(symbol_table symbols);
+
+void release_property_keys();
+
 /* here is a way for users to iterate through each property of a group */
 typedef void (property_func)(const char *property_group, const char *name, const char *value, void *user_data);
 
@@ -55,4 +101,9 @@ void each_property(symbol_table st, const char *property_group, property_func f,
 
 void remove_properties(symbol_table st, const char *property_group);
 
+/* split text of the form  key separator value terminator ... into properties of 
+   the result group */
+void interpret_properties(symbol_table st, const char *result_group, const char *text,
+	const char *field_separator, const char *field_terminator);
+
 #endif
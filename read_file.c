@@ -28,6 +28,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "plugin.h"
 #include "property.h"
 
+static const char *plugin_properties[] = { "MAXBUFSIZE" };
+static property_key_set plugin_keys = PROPERTY_KEY_SET(plugin_properties);
+
 #ifdef BUILD_PLUGIN
 EXPORT
 #else
@@ -53,7 +56,7 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
             long offset;
             if (!buf) {
                 if (!buflen)
-                    buflen = lookup_int_property(variables, argv[0], "MAXBUFSIZE", 5000);
+                    buflen = lookup_key_int(group_keys(&plugin_keys, variables, argv[0])[0], 5000);
                 buf = malloc(buflen);
             }
             fseek(f, 0, SEEK_END);
@@ -103,6 +106,7 @@ int main(int argc, const char *argv[])
     set_verbose(1);
 	if (!res) return 1;
 	printf("%s", res);
+	release_table_property_keys(symbols);
 	free_symbol_table(symbols);
     if (res!= buf) free(res);
 	if (buf)free(buf);
@@ -26,9 +26,138 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include "regular_expressions.h"
 #include "symboltable.h"
+#include "numbers.h"
+
+/* skip a bracket expression, p points at the opening [ */
+static const char *skip_bracket(const char *p)
+{
+  p++;
+  if (*p == '^') p++;
+  if (*p == ']') p++;
+  while (*p && *p != ']')
+  {
+    if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+    {
+      char close = p[1];
+      p += 2;
+      while (*p && !(*p == close && p[1] == ']')) p++;
+      if (*p) p += 2;
+    }
+    else
+      p++;
+  }
+  return (*p) ? p + 1 : p;
+}
+
+/* skip a parenthesised subexpression, p points at the opening ( */
+static const char *skip_group(const char *p)
+{
+  int depth = 0;
+  while (*p)
+  {
+    if (*p == '\\' && p[1])
+      p += 2;
+    else if (*p == '[')
+      p = skip_bracket(p);
+    else
+    {
+      if (*p == '(')
+        depth++;
+      else if (*p == ')' && --depth == 0)
+        return p + 1;
+      p++;
+    }
+  }
+  return p;
+}
+
+/* 
+  find the longest run of ordinary characters that every match of the pattern 
+  must contain. Anything optional, repeated or bracketed ends a run and a 
+  pattern with alternatives at the top level has no required literal at all.
+*/
+static char *required_literal(const char *pat)
+{
+  char *run = malloc(strlen(pat) + 1);
+  char *best = malloc(strlen(pat) + 1);
+  int run_len = 0;
+  int best_len = 0;
+  const char *p = pat;
+  while (*p)
+  {
+    int literal = 0;
+    int optional = 0;
+    int repeated = 0;
+    char ch = 0;
+    if (*p == '|')
+    {
+      best_len = 0;
+      break;
+    }
+    if (*p == '\\' && p[1])
+    {
+      /* \< \> \` and \' are anchors rather than characters */
+      literal = ispunct((unsigned char)p[1]) && !strchr("<>`'", p[1]);
+      ch = p[1];
+      p += 2;
+    }
+    else if (*p == '[')
+      p = skip_bracket(p);
+    else if (*p == '(')
+      p = skip_group(p);
+    else if (strchr(".^$)*+?{", *p))
+    {
+      if (*p == '{')
+        while (*p && *p != '}') p++;
+      if (*p) p++;
+    }
+    else
+    {
+      literal = 1;
+      ch = *p++;
+    }
+    if (*p == '*' || *p == '?')
+    {
+      optional = 1;
+      p++;
+    }
+    else if (*p == '+')
+    {
+      repeated = 1;
+      p++;
+    }
+    else if (*p == '{')
+    {
+      optional = (p[1] == '0' || p[1] == ',');
+      repeated = 1;
+      while (*p && *p != '}') p++;
+      if (*p) p++;
+    }
+    if (literal && !optional)
+      run[run_len++] = ch;
+    if (!literal || optional || repeated || !*p)
+    {
+      if (run_len > best_len)
+      {
+        memcpy(best, run, run_len);
+        best_len = run_len;
+      }
+      run_len = 0;
+    }
+  }
+  free(run);
+  if (best_len == 0)
+  {
+    free(best);
+    return NULL;
+  }
+  best[best_len] = 0;
+  return best;
+}
 
 rexp_info *create_pattern(const char *pat)
 {
@@ -36,6 +165,7 @@ rexp_info *create_pattern(const char *pat)
   info->pattern = strdup(pat);
   info->compilation_error = NULL;
   info->matches = NULL;
+  info->literal = NULL;
   info->compilation_result = regcomp(&info->regex, pat, REG_EXTENDED);
   if (info->compilation_result != 0)
   {
@@ -47,11 +177,30 @@ rexp_info *create_pattern(const char *pat)
   {
     /* compiled ok, make space for matches */
     info->matches = malloc(sizeof(regmatch_t) * (info->regex.re_nsub+1));
+    info->literal = required_literal(pat);
   }
   return info;
 }
 
+/* the pattern cannot match if the string does not contain its literal */
+static int lacks_literal(rexp_info *info, const char *string)
+{
+  return info->literal != NULL && strstr(string, info->literal) == NULL;
+}
+
 int execute_pattern(rexp_info *info, const char *string)
+{
+	int res = 0;
+	if (info->compilation_result == 0)
+	{
+		if (lacks_literal(info, string))
+			return REG_NOMATCH;
+	 	res = regexec(&info->regex, string, info->regex.re_nsub+1, info->matches, 0);
+	}
+    return res;
+}
+
+int confirm_pattern(rexp_info *info, const char *string)
 {
 	int res = 0;
 	if (info->compilation_result == 0)
@@ -68,7 +217,9 @@ int execute_pattern(rexp_info *info, const char *string)
 int find_matches(rexp_info *info, symbol_table variables, const char *string)
 {
 	int res = 0;
-    remove_matching(variables, "REXP_"); /* clear any previous matches */
+    remove_symbols_with_prefix(variables, "REXP_"); /* clear any previous matches */
+	if (info->compilation_result == 0 && lacks_literal(info, string))
+		return REG_NOMATCH;
 	if (info->compilation_result == 0)
 	 	res = regexec(&info->regex, string, info->regex.re_nsub+1, info->matches, 0);
     
@@ -192,6 +343,8 @@ void release_pattern(rexp_info *info)
   free(info->pattern);
   if (info->matches != NULL)
     free(info->matches);
+  if (info->literal != NULL)
+    free(info->literal);
   free(info);
 }
 
@@ -209,7 +362,189 @@ int matches(const char *string, const char *pattern)
 
 int is_integer(const char *string)
 {
-	return matches(string, "^[-]{0,1}[0-9]+$");
+	return parse_integer(string, NULL);
+}
+
+/* 
+  A literal set is an Aho-Corasick automaton: a trie of the literals where 
+  each state also has a failure link to the state for the longest suffix of 
+  its text that is in the trie, and an output link to the nearest state on 
+  that chain where a literal ends. Transitions from the root are kept in a 
+  table since every character of the text that matches nothing passes 
+  through it.
+*/
+#define NO_STATE -1
+
+struct literal_state
+{
+  int first_edge;
+  int fail;
+  int literal; /* the literal ending at this state, or NO_STATE */
+  int output;
+};
+
+struct literal_edge
+{
+  int target;
+  int next;
+  unsigned char ch;
+};
+
+struct literal_set
+{
+  struct literal_state *states;
+  int num_states;
+  int states_size;
+  struct literal_edge *edges;
+  int num_edges;
+  int edges_size;
+  int num_literals;
+  int compiled;
+  int root[256];
+};
+
+static int new_literal_state(literal_set *set)
+{
+  struct literal_state *state;
+  if (set->num_states == set->states_size)
+  {
+    set->states_size = (set->states_size) ? set->states_size * 2 : 16;
+    set->states = realloc(set->states, set->states_size * sizeof(struct literal_state));
+  }
+  state = &set->states[set->num_states];
+  state->first_edge = NO_STATE;
+  state->fail = 0;
+  state->literal = NO_STATE;
+  state->output = NO_STATE;
+  return set->num_states++;
+}
+
+static int literal_child(literal_set *set, int s, unsigned char ch)
+{
+  int e;
+  for (e = set->states[s].first_edge; e != NO_STATE; e = set->edges[e].next)
+    if (set->edges[e].ch == ch)
+      return set->edges[e].target;
+  return NO_STATE;
+}
+
+literal_set *create_literal_set()
+{
+  literal_set *set = calloc(1, sizeof(literal_set));
+  new_literal_state(set);
+  return set;
+}
+
+int add_literal(literal_set *set, const char *literal)
+{
+  int s = 0;
+  const unsigned char *p;
+  for (p = (const unsigned char *)literal; *p; p++)
+  {
+    int t = literal_child(set, s, *p);
+    if (t == NO_STATE)
+    {
+      struct literal_edge *edge;
+      t = new_literal_state(set);
+      if (set->num_edges == set->edges_size)
+      {
+        set->edges_size = (set->edges_size) ? set->edges_size * 2 : 16;
+        set->edges = realloc(set->edges, set->edges_size * sizeof(struct literal_edge));
+      }
+      edge = &set->edges[set->num_edges];
+      edge->target = t;
+      edge->ch = *p;
+      edge->next = set->states[s].first_edge;
+      set->states[s].first_edge = set->num_edges++;
+    }
+    s = t;
+  }
+  if (set->states[s].literal == NO_STATE)
+  {
+    set->states[s].literal = set->num_literals++;
+    set->compiled = 0;
+  }
+  return set->states[s].literal;
+}
+
+int literal_set_size(literal_set *set)
+{
+  return set->num_literals;
+}
+
+static int next_literal_state(literal_set *set, int s, unsigned char ch)
+{
+  while (s != 0)
+  {
+    int t = literal_child(set, s, ch);
+    if (t != NO_STATE)
+      return t;
+    s = set->states[s].fail;
+  }
+  return set->root[ch];
+}
+
+/* set the failure and output links, breadth first so shorter suffixes are done first */
+static void compile_literal_set(literal_set *set)
+{
+  int *queue = malloc(set->num_states * sizeof(int));
+  int head = 0;
+  int tail = 0;
+  int e;
+  int i;
+  for (i=0; i<256; i++)
+    set->root[i] = 0;
+  for (e = set->states[0].first_edge; e != NO_STATE; e = set->edges[e].next)
+  {
+    int u = set->edges[e].target;
+    set->root[set->edges[e].ch] = u;
+    set->states[u].fail = 0;
+    set->states[u].output = NO_STATE;
+    queue[tail++] = u;
+  }
+  while (head < tail)
+  {
+    int r = queue[head++];
+    for (e = set->states[r].first_edge; e != NO_STATE; e = set->edges[e].next)
+    {
+      int u = set->edges[e].target;
+      int f = next_literal_state(set, set->states[r].fail, set->edges[e].ch);
+      set->states[u].fail = f;
+      set->states[u].output = (f != 0 && set->states[f].literal != NO_STATE) ? f : set->states[f].output;
+      queue[tail++] = u;
+    }
+  }
+  free(queue);
+  set->compiled = 1;
+}
+
+void find_literals(literal_set *set, const char *text, unsigned char *found)
+{
+  const unsigned char *p;
+  int s = 0;
+  if (!set->compiled)
+    compile_literal_set(set);
+  memset(found, 0, set->num_literals);
+  if (set->states[0].literal != NO_STATE)
+    found[set->states[0].literal] = 1; /* the empty string */
+  for (p = (const unsigned char *)text; *p; p++)
+  {
+    int t;
+    s = next_literal_state(set, s, *p);
+    t = (set->states[s].literal != NO_STATE) ? s : set->states[s].output;
+    while (t != NO_STATE)
+    {
+      found[set->states[t].literal] = 1;
+      t = set->states[t].output;
+    }
+  }
+}
+
+void release_literal_set(literal_set *set)
+{
+  free(set->states);
+  free(set->edges);
+  free(set);
 }
 
 #ifdef TESTING
@@ -315,8 +650,12 @@ int main(int argc, char *argv[])
             rexp_info *info;
             if (matches(text, pattern))
                 printf("%s matches %s \n", text, pattern);
+            if (is_integer(text))
+                printf("%s is an integer\n", text);
 
             info = create_pattern(pattern);
+            if (info->literal)
+                printf("%s requires %s\n", pattern, info->literal);
             each_match(info, text, my_match_func, NULL);
             if (subs)
             {
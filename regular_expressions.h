@@ -34,12 +34,20 @@ typedef struct rexp_info
   char *compilation_error;
   regex_t regex;
   regmatch_t *matches;
+  char *literal; /* text that every match must contain, or NULL */
 } rexp_info;
 
 rexp_info *create_pattern(const char *pat);
 
+/* returns zero if the pattern matches the string. A string that does not
+   contain the literal required by the pattern is rejected without running 
+   the regular expression.
+*/
 int execute_pattern(rexp_info *info, const char *string);
 
+/* as execute_pattern(), for a string already known to contain the literal */
+int confirm_pattern(rexp_info *info, const char *string);
+
 void release_pattern(rexp_info *info);
 
 int matches(const char *string, const char *pattern);
@@ -67,4 +75,19 @@ typedef int (match_func)(const char *match, void *user_data);
 int each_match(rexp_info *info, const char *text, match_func f, void *user_data);
 
 
+/* a set of literal strings that can all be looked for in one pass over a text */
+typedef struct literal_set literal_set;
+
+literal_set *create_literal_set();
+
+/* returns the index of the literal in the set, adding it if necessary */
+int add_literal(literal_set *set, const char *literal);
+
+int literal_set_size(literal_set *set);
+
+/* sets found[i] to 1 if literal i occurs in the text and to 0 if it does not */
+void find_literals(literal_set *set, const char *text, unsigned char *found);
+
+void release_literal_set(literal_set *set);
+
 #endif
@@ -87,7 +87,6 @@ static void display_string(const char *str)
 struct message_data
 {
   const char *property_group;
-  symbol_table properties;
   char *buffer;
   const char *field_header;
   const char *field_separator;
@@ -108,6 +107,19 @@ static void build_message(const char *property_group, const char *name,
 
 #define ABORT goto error_exit
 
+/* the properties of a connection group, in the order of connection_properties */
+enum { SOCKET_KEY, PERSISTENT_KEY, HOST_KEY, PORT_KEY, TIMEOUT_KEY, RESPONSE_TERMINATOR_KEY,
+  MESSAGE_HEADER_KEY, MESSAGE_SEPARATOR_KEY, MESSAGE_TERMINATOR_KEY, 
+  FIELD_HEADER_KEY, FIELD_SEPARATOR_KEY, FIELD_TERMINATOR_KEY, INTERPRET_RESULT_KEY };
+
+static const char *connection_properties[] = { "SOCKET", "PERSISTENT", "HOST", "PORT", "TIMEOUT", 
+  "RESPONSE_TERMINATOR", "MESSAGE_HEADER", "MESSAGE_SEPARATOR", "MESSAGE_TERMINATOR", 
+  "FIELD_HEADER", "FIELD_SEPARATOR", "FIELD_TERMINATOR", "INTERPRET_RESULT" };
+static property_key_set connection_keys = PROPERTY_KEY_SET(connection_properties);
+
+static const char *plugin_properties[] = { "MAXBUFSIZE" };
+static property_key_set plugin_keys = PROPERTY_KEY_SET(plugin_properties);
+
 #ifdef BUILD_PLUGIN
 EXPORT
 #else
@@ -121,6 +133,8 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
   int buflen = user_buflen;
   const char *property_group;
   const char *command;
+  property_key *keys = NULL;
+  property_key socket_key = NULL;
   int sock;
 
   memset(&message, 0, sizeof(struct message_data));
@@ -130,6 +144,8 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
     const char *lookup;
     property_group = argv[1];
     command = argv[2];
+    keys = group_keys(&connection_keys, variables, property_group);
+    socket_key = keys[SOCKET_KEY];
     lookup = get_string_value(variables, command);
     if (lookup)
       command = lookup;
@@ -141,14 +157,14 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
   /* parse and check command parameters */
   if (argc==3 && strcmp(argv[2], "CLOSE") == 0)
   {
-    sock = lookup_int_property(variables, property_group, "SOCKET", 0);
+    sock = lookup_key_int(socket_key, 0);
     if (sock)
     {
       if (verbose())
         printf("Closing persistent connection\n");
       shutdown(sock, SHUT_RDWR);
       close(sock);
-      set_int_property(variables, property_group, "SOCKET", 0);
+      set_key_int(socket_key, 0);
     }
     ABORT;
   }
@@ -182,18 +198,18 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
     fd_set stream_error;
     int is_persistent = 0;
 
-    is_persistent = lookup_boolean_property(variables, property_group, "PERSISTENT", 0);
-    host_name = lookup_string_property(variables, property_group, "HOST", dest_address);
+    is_persistent = lookup_key_boolean(keys[PERSISTENT_KEY], 0);
+    host_name = lookup_key_string(keys[HOST_KEY], dest_address);
 
-    dest_port = lookup_int_property(variables, property_group, "PORT", dest_port);
+    dest_port = lookup_key_int(keys[PORT_KEY], dest_port);
     if (verbose())
       printf("using host: %s and port %d\n", host_name, dest_port);
 
-    timeout = lookup_int_property(variables, property_group, "TIMEOUT", timeout);
+    timeout = lookup_key_int(keys[TIMEOUT_KEY], timeout);
     if (verbose())
       printf("using timeout %d\n", timeout);
 
-    response_terminator = lookup_string_property(variables, property_group, "RESPONSE_TERMINATOR", NULL);
+    response_terminator = lookup_key_string(keys[RESPONSE_TERMINATOR_KEY], NULL);
     if (verbose() && response_terminator)
     {
       printf("reading until reponse: ");
@@ -205,14 +221,14 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
      DEFINE PERSISTENT = YES; # when connected the value TESTSOCK_SOCKET will be nonzero
      */
     /* look for an existing socket for the connection and use it if we find one */
-    sock = lookup_int_property(variables, property_group, "SOCKET", 0);
+    sock = lookup_key_int(socket_key, 0);
     if (sock == 0)
     {
       char *response = NULL;
       int flags;
       struct sockaddr_in address;
 
-      set_int_property(variables, property_group, "SOCKET", 0);
+      set_key_int(socket_key, 0);
       if ( inet_aton(host_name, &(address.sin_addr)) != INADDR_NONE
            && address.sin_addr.s_addr != 0 )
       {
@@ -342,27 +358,22 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
         PRINT3("fcntl F_SETFL (clear O_NONBLOCK): %s (%d)\n", strerror(errno), errno);
         shutdown(sock, SHUT_RDWR);
         close(sock);
-        set_int_property(variables, property_group, "SOCKET", 0);
+        set_key_int(socket_key, 0);
         return NULL;
       }
 
-      set_int_property(variables, property_group, "SOCKET", sock);
+      set_key_int(socket_key, sock);
     }
 
     if (message.property_group)
     {
-      message.properties = collect_properties(variables, property_group);
       message.buffer = NULL;
-      /*
-      fprintf(stderr, "\nMessage Properties: ");
-      dump_symbol_table(message.properties);
-      */
-      message.message_header = lookup_string_property(message.properties, property_group, "MESSAGE_HEADER", "");
-      message.message_separator = lookup_string_property(message.properties, property_group, "MESSAGE_SEPARATOR", "\r\n");
-      message.message_tail = lookup_string_property(message.properties, property_group, "MESSAGE_TERMINATOR", "");
-      message.field_header = lookup_string_property(message.properties, property_group, "FIELD_HEADER", "");
-      message.field_separator = lookup_string_property(message.properties, property_group, "FIELD_SEPARATOR", "|");
-      message.field_tail = lookup_string_property(message.properties, property_group, "FIELD_TERMINATOR", "");
+      message.message_header = lookup_key_string(keys[MESSAGE_HEADER_KEY], "");
+      message.message_separator = lookup_key_string(keys[MESSAGE_SEPARATOR_KEY], "\r\n");
+      message.message_tail = lookup_key_string(keys[MESSAGE_TERMINATOR_KEY], "");
+      message.field_header = lookup_key_string(keys[FIELD_HEADER_KEY], "");
+      message.field_separator = lookup_key_string(keys[FIELD_SEPARATOR_KEY], "|");
+      message.field_tail = lookup_key_string(keys[FIELD_TERMINATOR_KEY], "");
     }
 
     FD_ZERO(&read_ready);
@@ -372,13 +383,7 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
         build a message */
     if (message.property_group)
     {
-      symbol_table fields = collect_properties(variables, message.property_group);
-      /*
-      fprintf(stderr, "Message Fields:");
-      dump_symbol_table(fields);
-      */
-      each_property(fields, message.property_group, build_message, &message);
-      free_symbol_table(fields);
+      each_property(variables, message.property_group, build_message, &message);
       if (message.buffer == NULL)
       {
         fprintf(stderr, "Failed to find property list %s. Aborting send\n", message.property_group );
@@ -388,11 +393,8 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
           if (err <0)
             PRINT3("shutdown socket %s (%d)\n", strerror(errno), errno);
         }
-        if (message.properties)
-        {
-          free_symbol_table(message.properties);
+        if (message.property_group)
           free((char *)command);
-        }
         return NULL;
       }
       /* remove the extra field separator on the last field */
@@ -418,12 +420,9 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
       if (err != 0) PRINT3("shutdown: %s (%d)\n", strerror(errno), errno);
       err = close(sock);
       if (err != 0) PRINT3("shutdown: %s (%d)\n", strerror(errno), errno);
-      set_int_property(variables, property_group, "SOCKET", 0);
-      if (message.properties)
-      {
-        free_symbol_table(message.properties);
+      set_key_int(socket_key, 0);
+      if (message.property_group)
         free((char *)command);
-      }
       return NULL;
     }
     if (!is_persistent)
@@ -440,7 +439,7 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
     if (!buf)
     {
       if (!buflen)
-        buflen = lookup_int_property(variables, argv[0], "MAXBUFSIZE", 0);
+        buflen = lookup_key_int(group_keys(&plugin_keys, variables, argv[0])[0], 0);
       if (!buflen)
         buflen = 5000; /*TBD*/
       buf = malloc(buflen);
@@ -506,60 +505,21 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
         if (err != 0) PRINT3("shutdown: %s (%d)\n", strerror(errno), errno);
         err = close(sock);
         if (err != 0) PRINT3("shutdown: %s (%d)\n", strerror(errno), errno);
-        set_int_property(variables, property_group, "SOCKET", 0);
-        if (message.properties)
-        {
-          free_symbol_table(message.properties);
+        set_key_int(socket_key, 0);
+        if (message.property_group)
           free((char *)command);
-        }
         return NULL;
       }
       buf[num_bytes] = 0;
 
       /* the data may be in a key-value form, attempt to analyse it if the user wants us to */
-      if (num_bytes && message.property_group && lookup_boolean_property(variables, property_group, "INTERPRET_RESULT", 0))
+      if (num_bytes && message.property_group && lookup_key_boolean(keys[INTERPRET_RESULT_KEY], 0))
       {
-        /* Note, this code was the template for interpret_text() in splitstring.c  That
-            version should now be called from here instead. TBD
-         */
-        char *next = buf;
-        char *fldsep = strstr(next, message.field_separator);
-        char *fldterm = strstr(next, message.field_tail);
-        int seplen = strlen(message.field_separator);
-        int termlen = strlen(message.field_tail);
-        /* if there are no more field terminators, we are done */
-        while (fldterm)
-        {
-          if (!fldsep) break;
-
-          /* normally a field terminator wouldn't appear before the next separator
-          	but this can happen if not all sections of the output are in the
-          	key-value form (eg if the response has header text)
-           */
-          if (fldterm - next > fldsep - next)
-          {
-            int keylen = fldsep - next;
-            int valuelen = fldterm - fldsep - seplen;
-            char *key = malloc(keylen + 1);
-            char *value = malloc(valuelen + 1);
-            memmove(key, next, keylen);
-            key[keylen] = 0;
-            memmove(value, fldsep + seplen, valuelen);
-            value[valuelen] = 0;
-            if (verbose())
-              fprintf(stderr, "returning result parameter: %s: %s\n", key, value);
-            set_string_property(variables, "RESULT", key, value);
-            free(key);
-            free(value);
-          }
-          next = fldterm + termlen;
-          fldsep = strstr(next, message.field_separator);
-          fldterm = strstr(next, message.field_tail);
-        }
+        interpret_properties(variables, "RESULT", buf, message.field_separator, message.field_tail);
       }
     }
 
-    /*is_persistent = lookup_boolean_property(variables, property_group, "PERSISTENT", 0);*/
+    /*is_persistent = lookup_key_boolean(keys[PERSISTENT_KEY], 0);*/
     if (num_bytes == 0 || !is_persistent)
     {
       if (num_bytes == 0)
@@ -567,16 +527,13 @@ char *plugin_func(symbol_table variables, char *user_buf, int user_buflen, int a
       else
         fprintf(stderr, "Closing non-persistent connection\n");
       close(sock);
-      set_int_property(variables, property_group, "SOCKET", 0);
+      set_key_int(socket_key, 0);
     }
     if (verbose())
       printf("Buffer: %s\n", buf);
   }
   if (message.property_group)
-  {
-    free_symbol_table(message.properties);
     free((char *)command);
-  }
   return buf;
 error_exit:
   if (MESSAGE_BUFFER != NULL)
@@ -610,6 +567,7 @@ int main(int argc, const char *argv[])
   if (!res) return 1;
   printf("%s\n", res);
 
+  release_table_property_keys(symbols);
   free_symbol_table(symbols);
   free(buf);
   return 0;
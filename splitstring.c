@@ -346,48 +346,18 @@ char ** split_string(const char *str)
 
 void interpret_text(symbol_table variables, const char *property_group, const char *result_group, const char *buf)
 {
-    symbol_table properties = collect_properties(variables, property_group);
-
 /*    const char *message_header = lookup_string_property(properties, property_group, "MESSAGE_HEADER", "");
     const char *message_separator = lookup_string_property(properties, property_group, "MESSAGE_SEPARATOR", "\r\n");
     const char *message_tail = lookup_string_property(properties, property_group, "MESSAGE_TERMINATOR", "");
     const char *field_header = lookup_string_property(properties, property_group, "FIELD_HEADER", "");
-*/    const char *field_separator = lookup_string_property(properties, property_group, "FIELD_SEPARATOR", ": ");
-    const char *field_tail = lookup_string_property(properties, property_group, "FIELD_TERMINATOR", "\r\n");
+*/
+    /* copy the separators, the results may be stored in the same property group */
+    char *field_separator = strdup(lookup_string_property(variables, property_group, "FIELD_SEPARATOR", ": "));
+    char *field_tail = strdup(lookup_string_property(variables, property_group, "FIELD_TERMINATOR", "\r\n"));
 
-    const char *next = buf;
-    char *fldsep = strstr(next, field_separator);
-    char *fldterm = strstr(next, field_tail);
-    int seplen = strlen(field_separator);
-    int termlen = strlen(field_tail);
-    /* if there are no more field terminators, we are done */
-    while (fldterm) 
-    {
-        if (!fldsep) break;
-        
-        /* normally a field terminator wouldn't appear before the next separator
-            but this can happen if not all sections of the output are in the 
-            key-value form (eg if the response has header text)
-         */
-        if (fldterm - next > fldsep - next)
-        {
-            int keylen = fldsep - next;
-            int valuelen = fldterm - fldsep - seplen;
-            char *key = malloc(keylen + 1);
-            char *value = malloc(valuelen + 1);
-            memmove(key, next, keylen);
-            key[keylen] = 0;
-            memmove(value, fldsep + seplen, valuelen);
-            value[valuelen] = 0;
-            set_string_property(variables, result_group, key, value);
-            free(key);
-            free(value);
-        }
-        next = fldterm + termlen;
-        fldsep = strstr(next, field_separator);
-        fldterm = strstr(next, field_tail);
-    }
-    free_symbol_table(properties);
+    interpret_properties(variables, result_group, buf, field_separator, field_tail);
+    free(field_separator);
+    free(field_tail);
 }
 
 #ifdef TESTING
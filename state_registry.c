@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state_registry.h"
+#include "symboltable.h"
+
+static state_info *state_table = NULL;
+static int table_size = 0;
+static int page_size = 8;
+
+void init_state_registry()
+{
+	state_table = NULL;
+	table_size = 0;
+}
+
+void release_state_registry()
+{
+	int i;
+	for (i=0; i<table_size; i++)
+		free(state_table[i].name);
+	free(state_table);
+	init_state_registry();
+}
+
+void register_state(int id, const char *name)
+{
+	if (id < 0) 
+		return;
+	if (id >= table_size)
+	{
+		/* grow the table, slots for unused ids have no name */
+		int new_size = (id / page_size + 1) * page_size;
+		state_info *new_table = malloc(new_size * sizeof(state_info));
+		memset(new_table, 0, new_size * sizeof(state_info));
+		if (table_size > 0)
+		{
+			memcpy(new_table, state_table, table_size * sizeof(state_info));
+			free(state_table);
+		}
+		state_table = new_table;
+		table_size = new_size;
+	}
+	if (state_table[id].name == NULL)
+	{
+		state_table[id].id = id;
+		state_table[id].name = strdup(name);
+	}
+}
+
+state_info *find_state(int id)
+{
+	if (id < 0 || id >= table_size || state_table[id].name == NULL)
+		return NULL;
+	return &state_table[id];
+}
+
+const char *state_name(int id)
+{
+	state_info *state = find_state(id);
+	return (state) ? state->name : NULL;
+}
+
+static int method_id(symbol_table variables, const char *prefix, const char *name)
+{
+	int result;
+	char *full_name = malloc(strlen(prefix) + strlen(name) + 2);
+	sprintf(full_name, "%s_%s", prefix, name);
+	result = get_integer_value(variables, full_name);
+	free(full_name);
+	return result;
+}
+
+void bind_state_methods(symbol_table variables)
+{
+	int i;
+	for (i=0; i<table_size; i++)
+	{
+		if (state_table[i].name)
+		{
+			state_table[i].entry_method = method_id(variables, "ENTRY", state_table[i].name);
+			state_table[i].poll_method = method_id(variables, "POLL", state_table[i].name);
+		}
+	}
+}
+
+void display_state_registry()
+{
+	int i;
+	printf("%-20s %10s %10s\n", "state", "entries", "polls");
+	for (i=0; i<table_size; i++)
+		if (state_table[i].name)
+			printf("%-20s %10ld %10ld\n", state_table[i].name, state_table[i].entries, state_table[i].polls);
+}
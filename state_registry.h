@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __STATE_REGISTRY_H__
+#define __STATE_REGISTRY_H__
+
+#include "symboltable.h"
+
+/* The state registry records what the main loop needs to know about each 
+   state, indexed by the id of the state's condition set, so that changing 
+   state does not involve searching symbol tables.
+ */
+
+typedef struct state_info
+{
+	int id; /* condition set id */
+	char *name;
+	int entry_method; /* ENTRY_name method id, zero if there is none */
+	int poll_method; /* POLL_name method id, zero if there is none */
+	long entries; /* number of times the state has been entered */
+	long polls; /* number of times the poll method has been run */
+} state_info;
+
+void init_state_registry();
+
+void release_state_registry();
+
+/* record the name of a state. The first name given for an id is kept. */
+void register_state(int id, const char *name);
+
+/* returns NULL if no state has been registered with this id */
+state_info *find_state(int id);
+
+/* returns NULL if no state has been registered with this id */
+const char *state_name(int id);
+
+/* look up the entry and poll methods of all states. This is done once
+   the configuration is loaded.
+ */
+void bind_state_methods(symbol_table variables);
+
+/* print each state with the number of times it has been entered and polled */
+void display_state_registry();
+
+#endif
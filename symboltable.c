@@ -28,29 +28,165 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "regular_expressions.h"
 
 /*
-This symbol table is intended to handle only a small number of symbols (half a dozen or so)
-but it should handle more if performance isn't a major factor
+Each symbol lives in a slot of the sym array. A slot keeps its number for the life of the
+table so that it can be handed out as a symbol_ref; removing a symbol only clears its value
+unless nobody holds a reference, in which case the slot is recycled.
+
+The slots of the defined symbols are listed in the order they were added so that 
+each_symbol() and dump_symbol_table() are predictable. Lookups by name go through an 
+open addressing hash index of slot numbers so that tables holding thousands of symbols 
+are still cheap to search. A second list keeps the defined slots sorted by name; all
+names sharing a prefix (eg the properties of a group) are adjacent in this list, 
+so a group can be visited or removed without looking at the rest of the table.
+New names are only appended to the sorted list; they are sorted and merged into 
+place in one pass the next time somebody asks for a prefix, so filling a table 
+does not move the list once per name.
+
+Removing a symbol leaves a gap in the insertion order list and the slot stays in the
+sorted list, keeping its name, until there are enough gaps to make it worth compacting
+both lists. Deletion is therefore cheap and the cost of compaction is shared across
+many removals. The arrays grow geometrically.
+
+A snapshot is a read only copy of a table that keeps the same slot numbers, so that 
+symbol references bound on the original table can be used to read the snapshot. The 
+pages of slots and the lists are shared with the original, each with a reference count, 
+and the original copies a page or a list before it next changes it. While a table is 
+shared it does not recycle the slots of removed symbols. Before a page is 
+first shared, the value of each of its symbols is prepared as both a string and an 
+integer and long values are moved into shared values, so reading a shared page never 
+modifies it and copying it does not copy any values. Names are shared values too.
+A private copy shares its storage in the same way but may be changed by its owner; 
+it has no watchers, and the symbols changed in it can be merged back into the table.
+
+A symbol may also hold a native integer. Integers set through set_integer_value() are 
+only converted to a string when somebody asks for the string, and the string buffer is 
+kept for reuse so that counters and timers do not churn the heap.
+
+Long values may instead be held in a shared_value, an immutable reference counted string.
+Copying such a value to another symbol, or handing it to a caller, only takes a reference
+and the bytes are never written while shared. A symbol that owns a malloced buffer gives
+the buffer to a shared_value the first time somebody asks to share it.
 */
 #define _SYMBOLTABLE_TYPECHECK_ 4393824L
+#define EMPTY_BUCKET -1
+#define MIN_INDEX_SIZE 16
+#define NOT_LISTED -1 /* position of a slot that is not currently a defined symbol */
+#define REMOVED_ENTRY -1 /* marks the place of a removed symbol in the order list */
+#define MIN_COMPACTION 16 /* do not bother compacting for fewer removed entries */
+
+/* value flags */
+#define STRING_VALID 1 /* value holds the current string */
+#define INTEGER_VALID 2 /* int_value holds atoi() of the current value */
+#define INTEGER_EXACT 4 /* the value was set as an integer; the string is its decimal form */
+#define INTEGER_STRING_SIZE 12 /* enough for any int */
+#define SMALL_VALUE_SIZE SYMBOL_BUFFER_SIZE /* values shorter than this are kept inside the symbol */
+#define SLOTS_PER_PAGE 32 /* symbols are allocated a page at a time and never move */
 	
 typedef struct var_symbol
 {
-	char *name;
-	char *value;
+	const char *name; /* the text of name_value, NULL if the slot is on the free list */
+	shared_value name_value;
+	char *value; /* either small or a malloced buffer. May be out of date if only INTEGER_VALID is set */
+	int value_size; /* bytes available at value */
+	int int_value;
+	int flags;
+	unsigned int hash; /* hash of the name, saves rehashing when the index grows */
+	int position; /* index into order, NOT_LISTED, or the next free slot if this one is free */
+	int bound; /* nonzero once a symbol_ref has been given out for this slot */
+	int in_sorted; /* nonzero while the slot is in the sorted list */
+	shared_value shared; /* the shared value held at value, if any */
+	struct symbol_watch *watchers; /* called when the value changes, only for bound slots. Not owned by a snapshot */
+	int watch_pending; /* the symbol was removed and the watchers have not been told */
+	unsigned int generation; /* the table generation when the symbol last changed */
+	char small[SMALL_VALUE_SIZE];
 } var_symbol;
 
+/* a page of slots, shared by a table and its snapshots until the table changes it */
+typedef struct symbol_page
+{
+	int refs; /* changed atomically; a snapshot may be released on another thread */
+	int prepared; /* every defined slot holds both forms of its value and no private buffer */
+	var_symbol slots[SLOTS_PER_PAGE];
+} symbol_page;
+
+/* the order, sorted and index lists are preceded by a reference count and are
+   shared with snapshots in the same way as the pages
+ */
+typedef struct list_header
+{
+	int refs;
+	int unused; /* keeps the entries aligned */
+} list_header;
+
+/* the number of snapshots and private copies still sharing a table's slots, 
+   plus one for the table itself so that either may be released first
+ */
+typedef struct share_count
+{
+	int refs; /* changed atomically; a snapshot may be released on another thread */
+} share_count;
+
+typedef struct symbol_watch
+{
+	struct symbol_watch *next;
+	symbol_watcher *func;
+	void *user_data;
+} symbol_watch;
+
+struct shared_value_internal
+{
+	int refs; /* changed atomically; a snapshot may be released on another thread */
+	int length;
+	char *text; /* either text_buf or a buffer handed over by adopt_shared_value() */
+	char text_buf[1];
+};
+
+
+/* a bucket keeps a copy of the hash so that a probe only reads the slot it is 
+   looking for, not every slot it passes on the way. 
+ */
+typedef struct index_bucket
+{
+	int slot;
+	unsigned int hash;
+} index_bucket;
 
 typedef struct symbol_table_internal
 {
 	long typecheck_id;
-	int num_entries;
-	int page_size; /* grow the symbol table in this size chunks */
-	int table_size;
+	int num_entries; /* number of defined symbols */
+	int page_size; /* the initial size of the symbol table */
+	int table_size; /* slots available in the allocated pages */
+	int num_pages;
+	int pages_size; /* space allocated for the page list */
+	int sorted_size; /* space allocated for the sorted list */
+	int order_length; /* entries in order, including removed entries */
+	int order_size; /* space allocated for order */
+	int num_removed; /* removed entries in order */
+	int num_sorted; /* entries in the sorted list, including removed symbols */
+	int num_unsorted; /* entries at the end of the sorted list not yet in name order */
+	int num_slots; /* slots that have been used at some time */
+	int num_named; /* slots that currently have a name and an entry in the index */
+	int free_slot; /* head of the list of recycled slots */
+	int read_only; /* nonzero for a snapshot */
+	int private_copy; /* nonzero for a copy made by copy_symbol_table() */
+	unsigned int copied_generation; /* the generation of the table when a private copy was refreshed */
+	unsigned int binding; /* see binding_generation() */
+	share_count *sharers; /* of this table, NULL until it is first shared */
+	share_count *shared_from; /* the count of the table a snapshot or private copy shares */
+	int watch_pending; /* removed symbols whose watchers have not been told */
+	unsigned int generation; /* counts changes to the symbols, see ref_generation() */
 	int found_key;
-	var_symbol *sym;
+	symbol_page **pages;
+	int *order; /* slots of the defined symbols, in the order they were added */
+	int *sorted; /* slots of the defined (and recently removed) symbols, sorted by name */
+	index_bucket *index; /* hash buckets holding slot numbers, or EMPTY_BUCKET */
+	int index_size; /* number of buckets, always a power of two */
 } symbol_table_internal;
 typedef symbol_table_internal *stp;
 
+#define SLOT(symbol_table_p, slot) ((symbol_table_p)->pages[(slot) / SLOTS_PER_PAGE]->slots[(slot) % SLOTS_PER_PAGE])
+
 symbol_table_internal *reveal(symbol_table hidden)
 {
 	long *check = (long*)hidden;
@@ -63,6 +199,304 @@ symbol_table_internal *reveal(symbol_table hidden)
 	}
 }
 
+/* snapshots may not be changed */
+static int writable(symbol_table_internal *symbol_table_p)
+{
+	if (symbol_table_p == NULL)
+		return 0;
+	if (symbol_table_p->read_only)
+	{
+		fprintf(stderr, "error: attempt to change a symbol table snapshot\n");
+		return 0;
+	}
+	return 1;
+}
+
+/* shared values */
+
+shared_value new_shared_value(const char *text)
+{
+	int len = strlen(text);
+	shared_value result = malloc(sizeof(struct shared_value_internal) + len);
+	result->refs = 1;
+	result->length = len;
+	result->text = result->text_buf;
+	memcpy(result->text_buf, text, len + 1);
+	return result;
+}
+
+shared_value adopt_shared_value(char *text)
+{
+	shared_value result = malloc(sizeof(struct shared_value_internal));
+	result->refs = 1;
+	result->length = strlen(text);
+	result->text = text;
+	return result;
+}
+
+shared_value retain_shared_value(shared_value v)
+{
+	if (v) __sync_add_and_fetch(&v->refs, 1);
+	return v;
+}
+
+void release_shared_value(shared_value v)
+{
+	if (v && __sync_sub_and_fetch(&v->refs, 1) == 0)
+	{
+		if (v->text != v->text_buf)
+			free(v->text);
+		free(v);
+	}
+}
+
+const char *shared_value_text(shared_value v)
+{
+	return (v) ? v->text : NULL;
+}
+
+int shared_value_length(shared_value v)
+{
+	return (v) ? v->length : 0;
+}
+
+/* reference counted lists */
+
+static void *new_list(int count, int entry_size)
+{
+	list_header *header = malloc(sizeof(list_header) + count * entry_size);
+	header->refs = 1;
+	return header + 1;
+}
+
+static void retain_list(void *list)
+{
+	if (list) __sync_add_and_fetch(&((list_header *)list - 1)->refs, 1);
+}
+
+static void release_list(void *list)
+{
+	list_header *header = (list) ? (list_header *)list - 1 : NULL;
+	if (header && __sync_sub_and_fetch(&header->refs, 1) == 0)
+		free(header);
+}
+
+/* a list that may be changed: if a snapshot shares it, a copy with room for 
+   count entries holding the first used entries.
+ */
+static void *own_list(void *list, int count, int used, int entry_size)
+{
+	void *result;
+	if (list == NULL || __atomic_load_n(&((list_header *)list - 1)->refs, __ATOMIC_ACQUIRE) == 1)
+		return list;
+	result = new_list(count, entry_size);
+	memcpy(result, list, used * entry_size);
+	release_list(list);
+	return result;
+}
+
+static void own_order(symbol_table_internal *symbol_table_p)
+{
+	symbol_table_p->order = own_list(symbol_table_p->order, symbol_table_p->order_size, 
+		symbol_table_p->order_length, sizeof(int));
+}
+
+static void own_sorted(symbol_table_internal *symbol_table_p)
+{
+	symbol_table_p->sorted = own_list(symbol_table_p->sorted, symbol_table_p->sorted_size, 
+		symbol_table_p->num_sorted, sizeof(int));
+}
+
+static void own_index(symbol_table_internal *symbol_table_p)
+{
+	symbol_table_p->index = own_list(symbol_table_p->index, symbol_table_p->index_size, 
+		symbol_table_p->index_size, sizeof(index_bucket));
+}
+
+/* free the value buffer of a symbol unless it is stored inline */
+static void release_value(var_symbol *sym)
+{
+	if (sym->shared)
+	{
+		release_shared_value(sym->shared);
+		sym->shared = NULL;
+	}
+	else if (sym->value != sym->small)
+		free(sym->value);
+	sym->value = NULL;
+	sym->value_size = 0;
+}
+
+/* the string form of a symbol's value, generated from the integer value if necessary */
+static const char *string_of(var_symbol *sym)
+{
+	if ( !(sym->flags & STRING_VALID) && (sym->flags & INTEGER_VALID) )
+	{
+		if (sym->value_size < INTEGER_STRING_SIZE)
+		{
+			release_value(sym);
+			sym->value = sym->small;
+			sym->value_size = SMALL_VALUE_SIZE;
+		}
+		sprintf(sym->value, "%d", sym->int_value);
+		sym->flags |= STRING_VALID;
+	}
+	return (sym->flags & STRING_VALID) ? sym->value : NULL;
+}
+
+/* the integer value of a symbol, parsed from the string only once */
+static int integer_of(var_symbol *sym)
+{
+	if ( !(sym->flags & INTEGER_VALID) )
+	{
+		if ( !(sym->flags & STRING_VALID) )
+			return 0;
+		sym->int_value = atoi(sym->value);
+		sym->flags |= INTEGER_VALID;
+	}
+	return sym->int_value;
+}
+
+/* a reference to the current value of a symbol. A long value held in the 
+   symbol's own buffer is converted to a shared value without copying it.
+ */
+static shared_value share_entry_value(var_symbol *sym)
+{
+	const char *text = string_of(sym);
+	if (text == NULL)
+		return NULL;
+	if (sym->shared == NULL)
+	{
+		if (sym->value == sym->small)
+			return new_shared_value(text);
+		sym->shared = adopt_shared_value(sym->value);
+		sym->value_size = 0;
+	}
+	return retain_shared_value(sym->shared);
+}
+
+/* the text of a symbol's value, copying a short value into buf rather than sharing it */
+static const char *peek_entry_value(var_symbol *sym, char *buf, shared_value *value)
+{
+	const char *text = string_of(sym);
+	int len;
+	*value = NULL;
+	if (text == NULL)
+		return NULL;
+	len = strlen(text);
+	if (len < SMALL_VALUE_SIZE)
+	{
+		memcpy(buf, text, len + 1);
+		return buf;
+	}
+	*value = share_entry_value(sym);
+	return shared_value_text(*value);
+}
+
+/* pages */
+
+static symbol_page *new_page()
+{
+	symbol_page *page = malloc(sizeof(symbol_page));
+	memset(page, 0, sizeof(symbol_page));
+	page->refs = 1;
+	return page;
+}
+
+static void release_page(symbol_page *page)
+{
+	int i;
+	if (__sync_sub_and_fetch(&page->refs, 1) != 0)
+		return;
+	for (i=0; i<SLOTS_PER_PAGE; i++)
+	{
+		release_shared_value(page->slots[i].name_value);
+		release_value(&page->slots[i]);
+	}
+	free(page);
+}
+
+/* get a symbol ready to be read from several tables at once. A symbol that is 
+   not defined has nothing worth keeping.
+ */
+static void prepare_slot(var_symbol *sym)
+{
+	if (sym->name == NULL)
+		return;
+	if (sym->position == NOT_LISTED)
+	{
+		release_value(sym);
+		return;
+	}
+	string_of(sym);
+	integer_of(sym);
+	if (sym->shared == NULL && sym->value != sym->small)
+	{
+		sym->shared = adopt_shared_value(sym->value);
+		sym->value_size = 0;
+	}
+}
+
+static void prepare_page(symbol_page *page)
+{
+	int i;
+	if (page->prepared)
+		return;
+	for (i=0; i<SLOTS_PER_PAGE; i++)
+		prepare_slot(&page->slots[i]);
+	page->prepared = 1;
+}
+
+/* a private copy of a shared page. Shared pages are prepared, so their slots 
+   hold only inline values and references to shared values.
+ */
+static symbol_page *copy_page(symbol_page *page)
+{
+	symbol_page *result = malloc(sizeof(symbol_page));
+	int i;
+	/* the count may be changing on another thread, so it is not copied */
+	memcpy(result->slots, page->slots, sizeof(page->slots));
+	result->refs = 1;
+	result->prepared = page->prepared;
+	for (i=0; i<SLOTS_PER_PAGE; i++)
+	{
+		var_symbol *sym = &result->slots[i];
+		retain_shared_value(sym->name_value);
+		retain_shared_value(sym->shared);
+		if (sym->value == page->slots[i].small)
+			sym->value = sym->small;
+	}
+	release_page(page);
+	return result;
+}
+
+/* the acquire pairs with the release in release_page(), so a holder that has 
+   let go of the page has finished reading it before we change it
+ */
+static int page_shared(symbol_page *page)
+{
+	return __atomic_load_n(&page->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+/* the slot of a symbol that is about to change, first copying its page if a 
+   snapshot shares it
+ */
+static var_symbol *change_slot(symbol_table_internal *symbol_table_p, int slot)
+{
+	symbol_page **page = &symbol_table_p->pages[slot / SLOTS_PER_PAGE];
+	if (page_shared(*page))
+		*page = copy_page(*page);
+	(*page)->prepared = 0;
+	return &(*page)->slots[slot % SLOTS_PER_PAGE];
+}
+
+/* the symbol at a position of the order list, or NULL if it has been removed */
+static var_symbol *listed_symbol(symbol_table_internal *symbol_table_p, int i)
+{
+	int slot = symbol_table_p->order[i];
+	return (slot == REMOVED_ENTRY) ? NULL : &SLOT(symbol_table_p, slot);
+}
+
 /* initialisation of the class */
 symbol_table init_symbol_table()
 {
@@ -70,23 +504,153 @@ symbol_table init_symbol_table()
 	result->typecheck_id = _SYMBOLTABLE_TYPECHECK_;
 	result->num_entries = 0;
 	result->table_size = 0;
+	result->num_pages = 0;
+	result->pages_size = 0;
+	result->sorted_size = 0;
+	result->order_length = 0;
+	result->order_size = 0;
+	result->num_removed = 0;
+	result->num_sorted = 0;
+	result->num_unsorted = 0;
 	result->page_size = 8;
-	result->sym = NULL;
+	result->num_slots = 0;
+	result->num_named = 0;
+	result->free_slot = NO_SYMBOL;
+	result->read_only = 0;
+	result->private_copy = 0;
+	result->copied_generation = 0;
+	result->binding = 0;
+	result->sharers = NULL;
+	result->shared_from = NULL;
+	result->watch_pending = 0;
+	result->generation = 0;
+	result->pages = NULL;
+	result->order = NULL;
+	result->sorted = NULL;
+	result->index = NULL;
+	result->index_size = 0;
 	return (symbol_table)result;
 }
 
+/* FNV-1a; short, upper case names with common prefixes spread well enough */
+static unsigned int hash_name(const char *name)
+{
+	unsigned int h = 2166136261U;
+	while (*name)
+	{
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void index_insert(symbol_table_internal *symbol_table_p, int slot)
+{
+	unsigned int mask = symbol_table_p->index_size - 1;
+	unsigned int hash = SLOT(symbol_table_p, slot).hash;
+	unsigned int bucket = hash & mask;
+	own_index(symbol_table_p);
+	while (symbol_table_p->index[bucket].slot != EMPTY_BUCKET)
+		bucket = (bucket + 1) & mask;
+	symbol_table_p->index[bucket].slot = slot;
+	symbol_table_p->index[bucket].hash = hash;
+}
+
+/* take a slot out of the index. Later members of the probe sequence are shifted 
+   back into the gap so that no tombstones are needed.
+ */
+static void index_remove(symbol_table_internal *symbol_table_p, int slot)
+{
+	unsigned int mask = symbol_table_p->index_size - 1;
+	unsigned int hole = SLOT(symbol_table_p, slot).hash & mask;
+	unsigned int next;
+	own_index(symbol_table_p);
+	while (symbol_table_p->index[hole].slot != slot)
+		hole = (hole + 1) & mask;
+	next = (hole + 1) & mask;
+	while (symbol_table_p->index[next].slot != EMPTY_BUCKET)
+	{
+		unsigned int home = symbol_table_p->index[next].hash & mask;
+		if ( ((next - home) & mask) >= ((next - hole) & mask) )
+		{
+			symbol_table_p->index[hole] = symbol_table_p->index[next];
+			hole = next;
+		}
+		next = (next + 1) & mask;
+	}
+	symbol_table_p->index[hole].slot = EMPTY_BUCKET;
+}
+
+/* discard the hash index and rebuild it with room for the given number of names. 
+   The index is kept at most half full so that probe sequences stay short.
+ */
+static void resize_index(symbol_table_internal *symbol_table_p, int num_names)
+{
+	int size = MIN_INDEX_SIZE;
+	int i;
+	while (size < num_names * 2)
+		size *= 2;
+	if (size != symbol_table_p->index_size)
+	{
+		release_list(symbol_table_p->index);
+		symbol_table_p->index = new_list(size, sizeof(index_bucket));
+		symbol_table_p->index_size = size;
+	}
+	else
+		own_index(symbol_table_p);
+	for (i=0; i<size; i++)
+		symbol_table_p->index[i].slot = EMPTY_BUCKET;
+	for (i=0; i<symbol_table_p->num_slots; i++)
+		if (SLOT(symbol_table_p, i).name != NULL)
+			index_insert(symbol_table_p, i);
+}
+
+static void rebuild_index(symbol_table_internal *symbol_table_p)
+{
+	resize_index(symbol_table_p, symbol_table_p->num_named);
+}
+
+static void release_share_count(share_count **count)
+{
+	if (*count && __sync_sub_and_fetch(&(*count)->refs, 1) == 0)
+		free(*count);
+	*count = NULL;
+}
+
+/* release the pages and lists, which may be shared with snapshots. A snapshot 
+   or copy lets go of its table's count last, once it has stopped reading.
+ */
+static void release_contents(symbol_table_internal *symbol_table_p)
+{
+	int i;
+	for (i=0; i<symbol_table_p->num_pages; i++)
+		release_page(symbol_table_p->pages[i]);
+	free(symbol_table_p->pages);
+	release_list(symbol_table_p->order);
+	release_list(symbol_table_p->sorted);
+	release_list(symbol_table_p->index);
+	release_share_count(&symbol_table_p->shared_from);
+}
+
 /* release the memory occupied by the symbol table */
 void free_symbol_table(symbol_table st)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
+	int num_slots = symbol_table_p->num_slots;
 	int i;
-	for (i=0; i<num_entries; i++)
+	/* snapshots and private copies share the watchers of their table */
+	for (i=0; i<num_slots && !symbol_table_p->read_only && !symbol_table_p->private_copy; i++)
 	{
-		free(symbol_table_p->sym[i].name);
-		free(symbol_table_p->sym[i].value);
+		symbol_watch *w = SLOT(symbol_table_p, i).watchers;
+		while (w)
+		{
+			symbol_watch *next = w->next;
+			free(w);
+			w = next;
+		}
 	}
-	free(symbol_table_p->sym);
+	release_contents(symbol_table_p);
+	release_share_count(&symbol_table_p->sharers);
 	free(symbol_table_p);
 }
 
@@ -94,10 +658,15 @@ void free_symbol_table(symbol_table st)
 void dump_symbol_table(symbol_table st)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
+	int order_length;
 	int i;
-	for (i=0; i<num_entries; i++)
-		printf("%s: %s\n", symbol_table_p->sym[i].name, symbol_table_p->sym[i].value);
+	order_length = symbol_table_p->order_length;
+	for (i=0; i<order_length; i++)
+	{
+		var_symbol *sym = listed_symbol(symbol_table_p, i);
+		if (!sym) continue;
+		printf("%s: %s\n", sym->name, string_of(sym));
+	}
 }
 
 const char *name_lookup(symbol_table st, const char *name)
@@ -108,6 +677,15 @@ const char *name_lookup(symbol_table st, const char *name)
     return result;
 }
 
+/* snapshots may be read by several threads at once, so they do not record 
+   whether the last lookup found its symbol
+ */
+static void note_found(symbol_table_internal *symbol_table_p, int found)
+{
+	if (!symbol_table_p->read_only)
+		symbol_table_p->found_key = found;
+}
+
 int found_key(symbol_table st)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
@@ -123,13 +701,16 @@ symbol_table collect_matching(symbol_table st, const char *pattern)
 	/*fprintf(stderr, "attempting to find symbols matching %s\n", pattern);*/
 	
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
+	int order_length;
 	int i;
-	for (i=0; i<num_entries; i++)
+	order_length = symbol_table_p->order_length;
+	for (i=0; i<order_length; i++)
 	{
-		if (execute_pattern(info, symbol_table_p->sym[i].name) == 0)
+		var_symbol *sym = listed_symbol(symbol_table_p, i);
+		if (!sym) continue;
+		if (execute_pattern(info, sym->name) == 0)
 		{
-			set_string_value(result, symbol_table_p->sym[i].name, symbol_table_p->sym[i].value);
+			set_string_value(result, sym->name, string_of(sym));
 		}
 	}
     release_pattern(info);
@@ -137,75 +718,476 @@ symbol_table collect_matching(symbol_table st, const char *pattern)
 }
 
 
+/* returns the slot holding the given name, whether or not the symbol is currently 
+   defined, or NO_SYMBOL if the name has never been used.
+ */
+static int find_slot(symbol_table_internal *symbol_table_p, const char *name, unsigned int hash)
+{
+	unsigned int mask;
+	unsigned int bucket;
+	if (symbol_table_p->index == NULL)
+		return NO_SYMBOL;
+	mask = symbol_table_p->index_size - 1;
+	bucket = hash & mask;
+	while (symbol_table_p->index[bucket].slot != EMPTY_BUCKET)
+	{
+		int slot = symbol_table_p->index[bucket].slot;
+		if (symbol_table_p->index[bucket].hash == hash && strcmp(SLOT(symbol_table_p, slot).name, name) == 0)
+			return slot;
+		bucket = (bucket + 1) & mask;
+	}
+	return NO_SYMBOL;
+}
 
-/* returns the address of the symbol if found, otherwise, 
-  the address of the end of the table 
+/* returns the slot of the symbol if it is defined, otherwise NO_SYMBOL */
+static int defined_slot(symbol_table_internal *symbol_table_p, const char *name)
+{
+	int slot = find_slot(symbol_table_p, name, hash_name(name));
+	return (slot != NO_SYMBOL && SLOT(symbol_table_p, slot).position != NOT_LISTED) ? slot : NO_SYMBOL;
+}
+
+/* make room for at least the given number of new slots. Symbols are 
+   allocated in pages so that a symbol, and a value stored inside it, stays
+   at the same address while the table grows.
  */
+static void reserve_slots(symbol_table_internal *symbol_table_p, int count)
+{
+	int needed = symbol_table_p->num_slots + count;
+	while (needed > symbol_table_p->table_size)
+	{
+		if (symbol_table_p->num_pages == symbol_table_p->pages_size)
+		{
+			int new_size = (symbol_table_p->pages_size > 0) ? symbol_table_p->pages_size * 2 : 4;
+			symbol_page **new_pages = malloc(new_size * sizeof(symbol_page *));
+			if (symbol_table_p->num_pages > 0)
+				memcpy(new_pages, symbol_table_p->pages, symbol_table_p->num_pages * sizeof(symbol_page *));
+			free(symbol_table_p->pages);
+			symbol_table_p->pages = new_pages;
+			symbol_table_p->pages_size = new_size;
+		}
+		symbol_table_p->pages[symbol_table_p->num_pages++] = new_page();
+		symbol_table_p->table_size += SLOTS_PER_PAGE;
+	}
+	if (symbol_table_p->table_size > symbol_table_p->sorted_size)
+	{
+		/* grow the sorted list */
+		int new_size = (symbol_table_p->sorted_size > 0) ? symbol_table_p->sorted_size : symbol_table_p->page_size;
+		int *new_sorted;
+		while (new_size < symbol_table_p->table_size)
+			new_size *= 2;
+		new_sorted = new_list(new_size, sizeof(int));
+		if (symbol_table_p->num_sorted > 0)
+			memcpy(new_sorted, symbol_table_p->sorted, symbol_table_p->num_sorted * sizeof(int));
+		release_list(symbol_table_p->sorted);
+		symbol_table_p->sorted = new_sorted;
+		symbol_table_p->sorted_size = new_size;
+	}
+}
 
-static int find_symbol_address(symbol_table st, const char *name)
+/* symbols record the generation of their last change */
+static unsigned int next_generation(symbol_table_internal *symbol_table_p)
+{
+	return ++symbol_table_p->generation;
+}
+
+/* allocate a slot for a new name. The slot is indexed but not yet listed as defined */
+static int new_slot(symbol_table_internal *symbol_table_p, const char *name, unsigned int hash)
+{
+	int slot;
+	var_symbol *sym;
+	if (symbol_table_p->free_slot != NO_SYMBOL)
+	{
+		slot = symbol_table_p->free_slot;
+		symbol_table_p->free_slot = SLOT(symbol_table_p, slot).position;
+	}
+	else
+	{
+		reserve_slots(symbol_table_p, 1);
+		slot = symbol_table_p->num_slots++;
+	}
+	sym = change_slot(symbol_table_p, slot);
+	sym->name_value = new_shared_value(name);
+	sym->name = sym->name_value->text;
+	sym->value = NULL;
+	sym->value_size = 0;
+	sym->shared = NULL;
+	sym->flags = 0;
+	sym->hash = hash;
+	sym->position = NOT_LISTED;
+	sym->bound = 0;
+	sym->in_sorted = 0;
+	sym->watchers = NULL; /* recycled slots were never bound */
+	sym->watch_pending = 0;
+	sym->generation = next_generation(symbol_table_p);
+	symbol_table_p->num_named++;
+	if (symbol_table_p->num_named * 2 > symbol_table_p->index_size)
+		rebuild_index(symbol_table_p);
+	else
+		index_insert(symbol_table_p, slot);
+	return slot;
+}
+
+typedef struct named_slot
+{
+	const char *name;
+	int slot;
+} named_slot;
+
+static int compare_named_slots(const void *a, const void *b)
+{
+	return strcmp(((const named_slot *)a)->name, ((const named_slot *)b)->name);
+}
+
+/* put the names appended since the last prefix query into order: sort them 
+   and merge them with the rest of the list, working back from the end.
+ */
+static void sort_names(symbol_table_internal *symbol_table_p)
+{
+	int count = symbol_table_p->num_unsorted;
+	int *sorted;
+	named_slot *added;
+	int i, j, k;
+	if (count == 0)
+		return;
+	own_sorted(symbol_table_p);
+	sorted = symbol_table_p->sorted;
+	added = malloc(count * sizeof(named_slot));
+	j = symbol_table_p->num_sorted - count;
+	for (i=0; i<count; i++)
+	{
+		added[i].slot = sorted[j + i];
+		added[i].name = SLOT(symbol_table_p, added[i].slot).name;
+	}
+	qsort(added, count, sizeof(named_slot), compare_named_slots);
+	i = count - 1;
+	j--;
+	k = symbol_table_p->num_sorted - 1;
+	while (i >= 0)
+	{
+		if (j >= 0 && strcmp(SLOT(symbol_table_p, sorted[j]).name, added[i].name) > 0)
+			sorted[k--] = sorted[j--];
+		else
+			sorted[k--] = added[i--].slot;
+	}
+	free(added);
+	symbol_table_p->num_unsorted = 0;
+}
+
+/* nonzero while a snapshot or private copy may still read the slots of the 
+   table. The acquire pairs with the release in release_share_count().
+ */
+static int slots_shared(symbol_table_internal *symbol_table_p)
+{
+	return symbol_table_p->sharers != NULL
+		&& __atomic_load_n(&symbol_table_p->sharers->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+/* squeeze the removed entries out of the order and sorted lists. Removed slots 
+   that nobody holds a reference to are returned to the free list, except for
+   keep_slot which the caller is about to reuse. Slots are not recycled while a 
+   snapshot or copy shares them, as a reference bound for the new name would 
+   read the old one there, nor in a private copy, whose slot numbers would 
+   then differ from its table's.
+ */
+static void compact(symbol_table_internal *symbol_table_p, int keep_slot)
 {
-	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
 	int i;
-	symbol_table_p->found_key = 0;
-	for (i=0; i<num_entries; i++)
+	int n = 0;
+	int recycle = !symbol_table_p->private_copy && !slots_shared(symbol_table_p);
+	sort_names(symbol_table_p);
+	own_order(symbol_table_p);
+	own_sorted(symbol_table_p);
+	for (i=0; i<symbol_table_p->order_length; i++)
 	{
-		if (strcmp(symbol_table_p->sym[i].name, name) == 0)
+		int slot = symbol_table_p->order[i];
+		if (slot != REMOVED_ENTRY)
 		{
-			symbol_table_p->found_key = 1;
-			return i;
+			symbol_table_p->order[n] = slot;
+			if (SLOT(symbol_table_p, slot).position != n)
+				change_slot(symbol_table_p, slot)->position = n;
+			n++;
 		}
 	}
-	return num_entries;
+	symbol_table_p->order_length = n;
+	symbol_table_p->num_removed = 0;
+	n = 0;
+	for (i=0; i<symbol_table_p->num_sorted; i++)
+	{
+		int slot = symbol_table_p->sorted[i];
+		var_symbol *sym = &SLOT(symbol_table_p, slot);
+		if (sym->position != NOT_LISTED || (!recycle && !sym->bound))
+			symbol_table_p->sorted[n++] = slot; /* a slot not recycled now may be by a later compaction */
+		else 
+		{
+			sym = change_slot(symbol_table_p, slot);
+			sym->in_sorted = 0;
+			if (!sym->bound && slot != keep_slot)
+			{
+				index_remove(symbol_table_p, slot);
+				release_value(sym);
+				release_shared_value(sym->name_value);
+				sym->name_value = NULL;
+				sym->name = NULL;
+				sym->position = symbol_table_p->free_slot;
+				symbol_table_p->free_slot = slot;
+				symbol_table_p->num_named--;
+			}
+		}
+	}
+	symbol_table_p->num_sorted = n;
 }
 
+/* compact the lists once removed entries outnumber the defined ones */
+static void check_compaction(symbol_table_internal *symbol_table_p)
+{
+	if (symbol_table_p->num_removed >= MIN_COMPACTION 
+			&& symbol_table_p->num_removed > symbol_table_p->num_entries)
+		compact(symbol_table_p, NO_SYMBOL);
+}
 
-void remove_entry(symbol_table st, int pos)
+/* returns the first entry in the sorted list whose name is not less than the given name */
+static int sorted_position(symbol_table_internal *symbol_table_p, const char *name)
 {
-	symbol_table_internal *symbol_table_p = reveal(st);
-	if (pos < symbol_table_p->num_entries)
+	int lo = 0;
+	int hi = symbol_table_p->num_sorted;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (strcmp(SLOT(symbol_table_p, symbol_table_p->sorted[mid]).name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* make room to add entries to the order list, either by compacting it or by growing it */
+static void reserve_order(symbol_table_internal *symbol_table_p, int count, int keep_slot)
+{
+	int needed = symbol_table_p->order_length + count;
+	if (needed <= symbol_table_p->order_size)
+		return;
+	if (symbol_table_p->num_removed > symbol_table_p->order_length / 4)
+		compact(symbol_table_p, keep_slot);
+	needed = symbol_table_p->order_length + count;
+	if (needed > symbol_table_p->order_size)
+	{
+		int new_size = (symbol_table_p->order_size > 0) ? symbol_table_p->order_size * 2 : symbol_table_p->page_size;
+		int *new_order;
+		while (new_size < needed)
+			new_size *= 2;
+		new_order = new_list(new_size, sizeof(int));
+		if (symbol_table_p->order_length > 0)
+			memcpy(new_order, symbol_table_p->order, symbol_table_p->order_length * sizeof(int));
+		release_list(symbol_table_p->order);
+		symbol_table_p->order = new_order;
+		symbol_table_p->order_size = new_size;
+	}
+}
+
+/* add a slot to the end of the list of defined symbols */
+static void list_slot(symbol_table_internal *symbol_table_p, int slot)
+{
+	var_symbol *sym;
+	reserve_order(symbol_table_p, 1, slot);
+	own_order(symbol_table_p);
+	sym = change_slot(symbol_table_p, slot);
+	if (!sym->in_sorted)
+	{
+		own_sorted(symbol_table_p);
+		symbol_table_p->sorted[symbol_table_p->num_sorted++] = slot;
+		symbol_table_p->num_unsorted++;
+		sym->in_sorted = 1;
+	}
+	sym->position = symbol_table_p->order_length;
+	symbol_table_p->order[symbol_table_p->order_length++] = slot;
+	symbol_table_p->num_entries++;
+}
+
+/* undefine the symbol in the given slot. The slot keeps its name and stays in 
+   the index and the sorted list until the next compaction so that setting the
+   symbol again is cheap. The lists are not compacted here so callers may 
+   continue to walk them; use check_compaction() afterwards.
+ */
+static void remove_entry(symbol_table_internal *symbol_table_p, int slot)
+{
+	var_symbol *sym = &SLOT(symbol_table_p, slot);
+	if (sym->name == NULL || sym->position == NOT_LISTED)
+		return;
+	sym = change_slot(symbol_table_p, slot);
+	own_order(symbol_table_p);
+	symbol_table_p->order[sym->position] = REMOVED_ENTRY;
+	symbol_table_p->num_removed++;
+	symbol_table_p->num_entries--;
+	if (sym->shared)
+		release_value(sym); /* other holders may outlive us, there is nothing to reuse */
+	sym->flags = 0; /* the value buffer is kept in case the symbol is set again */
+	sym->position = NOT_LISTED;
+	sym->generation = next_generation(symbol_table_p);
+	if (sym->watchers && !symbol_table_p->private_copy)
+	{
+		sym->watch_pending = 1;
+		symbol_table_p->watch_pending++;
+	}
+}
+
+static void notify_watchers(symbol_table_internal *symbol_table_p, int slot)
+{
+	symbol_watch *w;
+	if (symbol_table_p->private_copy)
+		return; /* the watchers belong to the table it was copied from */
+	for (w = SLOT(symbol_table_p, slot).watchers; w; w = w->next)
+		w->func((symbol_table)symbol_table_p, slot, w->user_data);
+}
+
+/* tell the watchers of symbols that were removed. This is done once the
+   removal is finished so that watchers may look at the table.
+ */
+static void notify_removed(symbol_table_internal *symbol_table_p)
+{
+	int i;
+	if (symbol_table_p->watch_pending == 0)
+		return;
+	symbol_table_p->watch_pending = 0;
+	for (i=0; i<symbol_table_p->num_slots; i++)
 	{
-		free(symbol_table_p->sym[pos].name);
-		free(symbol_table_p->sym[pos].value);
-		while (pos < symbol_table_p->num_entries-1)
+		if (SLOT(symbol_table_p, i).watch_pending)
 		{
-			symbol_table_p->sym[pos] = symbol_table_p->sym[pos+1];
-			pos++;
+			change_slot(symbol_table_p, i)->watch_pending = 0;
+			notify_watchers(symbol_table_p, i);
 		}
-		symbol_table_p->num_entries--;
 	}
-	
 }
 
 void remove_symbol(symbol_table st, const char *name)
 {
-	remove_entry(st, find_symbol_address(st, name));
+	symbol_table_internal *symbol_table_p = reveal(st);
+	int slot;
+	if (!writable(symbol_table_p)) return;
+	slot = defined_slot(symbol_table_p, name);
+	if (slot != NO_SYMBOL)
+	{
+		remove_entry(symbol_table_p, slot);
+		check_compaction(symbol_table_p);
+	}
+	notify_removed(symbol_table_p);
 }
 
-/* return a new symbol table with all the symbols with a name matching the pattern */
+/* remove all the symbols with a name matching the pattern */
 void remove_matching(symbol_table st, const char *pattern)
 {
-	rexp_info *info = create_pattern(pattern);	
+	rexp_info *info;
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int i = 0;
-	while (i < symbol_table_p->num_entries)
+	int i;
+	if (!writable(symbol_table_p)) return;
+	info = create_pattern(pattern);
+	for (i=0; i<symbol_table_p->order_length; i++)
 	{
-		if (execute_pattern(info, symbol_table_p->sym[i].name) == 0)
-			remove_entry(st, i);
-		else
-			i++;
+		int slot = symbol_table_p->order[i];
+		if (slot != REMOVED_ENTRY && execute_pattern(info, SLOT(symbol_table_p, slot).name) == 0)
+			remove_entry(symbol_table_p, slot);
 	}
+	check_compaction(symbol_table_p);
+	notify_removed(symbol_table_p);
     release_pattern(info);
 	return;	
 }
 
+/* call f for the symbol in a slot if it is defined and its name begins with the 
+   prefix; an earlier callback may have released the slot
+ */
+static void visit_slot(symbol_table_internal *symbol_table_p, int slot, const char *prefix, 
+		symbol_func f, void *user_data)
+{
+	var_symbol *sym = &SLOT(symbol_table_p, slot);
+	if (sym->name && sym->position != NOT_LISTED && strncmp(sym->name, prefix, strlen(prefix)) == 0)
+		f(sym->name, string_of(sym), user_data);
+}
+
 void each_symbol(symbol_table st, symbol_func f, void *user_data)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
+	int order_length = symbol_table_p->order_length;
+	int i;
+	for (i=0; i<order_length; i++)
+	{
+		var_symbol *sym = listed_symbol(symbol_table_p, i);
+		if (!sym) continue;
+		f(sym->name, string_of(sym), user_data);
+	}
+}
+
+/* the range of the sorted list holding names that begin with the prefix. 
+   The caller must have put the list in order.
+ */
+static int prefix_range(symbol_table_internal *symbol_table_p, const char *prefix, int *first)
+{
+	int len = strlen(prefix);
+	int end;
+	*first = sorted_position(symbol_table_p, prefix);
+	end = *first;
+	while (end < symbol_table_p->num_sorted 
+			&& strncmp(SLOT(symbol_table_p, symbol_table_p->sorted[end]).name, prefix, len) == 0)
+		end++;
+	return end - *first;
+}
+
+#define PREFIX_BATCH 32
+
+typedef struct listed_slot
+{
+	int position;
+	int slot;
+} listed_slot;
+
+static int compare_positions(const void *a, const void *b)
+{
+	return ((const listed_slot *)a)->position - ((const listed_slot *)b)->position;
+}
+
+void each_symbol_with_prefix(symbol_table st, const char *prefix, symbol_func f, void *user_data)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	listed_slot local_slots[PREFIX_BATCH];
+	listed_slot *slots = local_slots;
+	int first;
+	int count;
+	int i;
+	sort_names(symbol_table_p);
+	count = prefix_range(symbol_table_p, prefix, &first);
+	if (count == 0) 
+		return;
+	if (count > PREFIX_BATCH)
+		slots = malloc(count * sizeof(listed_slot));
+	
+	/* the caller expects the symbols in the order they were added. The list of 
+	   slots also protects us from changes the callback may make to the table.
+	 */
+	for (i=0; i<count; i++)
+	{
+		slots[i].slot = symbol_table_p->sorted[first + i];
+		slots[i].position = SLOT(symbol_table_p, slots[i].slot).position;
+	}
+	qsort(slots, count, sizeof(listed_slot), compare_positions);
+	for (i=0; i<count; i++)
+		visit_slot(symbol_table_p, slots[i].slot, prefix, f, user_data);
+	if (slots != local_slots)
+		free(slots);
+}
+
+void remove_symbols_with_prefix(symbol_table st, const char *prefix)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	int first;
+	int count;
 	int i;
-	for (i=0; i<num_entries; i++)
-		f(symbol_table_p->sym[i].name, symbol_table_p->sym[i].value, user_data);
+	if (!writable(symbol_table_p)) return;
+	sort_names(symbol_table_p);
+	count = prefix_range(symbol_table_p, prefix, &first);
+	for (i=0; i<count; i++)
+		remove_entry(symbol_table_p, symbol_table_p->sorted[first + i]);
+	check_compaction(symbol_table_p);
+	notify_removed(symbol_table_p);
 }
 
 
@@ -217,22 +1199,27 @@ void each_symbol(symbol_table st, symbol_func f, void *user_data)
 const char *get_string_value_ending(symbol_table st, const char *suffix)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
+	int order_length;
 	int i;
-	symbol_table_p->found_key = 0;
-	for (i=0; i<num_entries; i++)
+	const char *result = NULL;
+	order_length = symbol_table_p->order_length;
+	for (i=0; i<order_length; i++)
 	{
-		const char *name = symbol_table_p->sym[i].name;
+		var_symbol *sym = listed_symbol(symbol_table_p, i);
+		const char *name;
+		if (!sym) continue;
+		name = sym->name;
 		int offset = 0;
 		if (strlen(name) > strlen(suffix))
 			offset += (strlen(name) - strlen(suffix));
 		if (strcmp(name + offset, suffix) == 0)
 		{
-			symbol_table_p->found_key = 1;
-			return name;
+			result = name;
+			break;
 		}
 	}
-	return NULL;	
+	note_found(symbol_table_p, result != NULL);
+	return result;	
 }
 
 
@@ -244,54 +1231,152 @@ const char *get_string_value_ending(symbol_table st, const char *suffix)
 const char *get_string_value_beginning(symbol_table st, const char *prefix)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
+	int order_length;
 	int i;
-	symbol_table_p->found_key = 0;
-	for (i=0; i<num_entries; i++)
+	const char *result = NULL;
+	order_length = symbol_table_p->order_length;
+	for (i=0; i<order_length; i++)
 	{
-		const char *name = symbol_table_p->sym[i].name;
+		var_symbol *sym = listed_symbol(symbol_table_p, i);
+		const char *name;
+		if (!sym) continue;
+		name = sym->name;
 		if (strncmp(name, prefix, strlen(prefix)) == 0)
 		{
-			symbol_table_p->found_key = 1;
-			return name;
+			result = name;
+			break;
 		}
 	}
-	return NULL;	
+	note_found(symbol_table_p, result != NULL);
+	return result;	
 }
 
-static void set_entry_value(symbol_table st, int address, const char *value)
+/* the new value is copied into the existing buffer when it fits. Short values
+   are kept inside the symbol and longer ones in a buffer that is only replaced
+   when a longer value arrives. A shared value is never written to, its 
+   value_size is zero.
+ */
+static void set_entry_value(symbol_table_internal *symbol_table_p, int slot, const char *value)
 {
-	symbol_table_internal *symbol_table_p = reveal(st);
-	char *old;
+	var_symbol *sym;
+	int len;
 	if (value == NULL) return; /* do not want null entries */	
-	if (address == symbol_table_p->table_size) return; /* just in case */
+	sym = change_slot(symbol_table_p, slot);
 	
-	old = symbol_table_p->sym[address].value;
-	symbol_table_p->sym[address].value = strdup(value);
-	if (old != NULL)
-		free(old);
+	len = strlen(value);
+	if (len < sym->value_size)
+		memmove(sym->value, value, len + 1); /* the value may overlap the current one */
+	else
+	{
+		char *old = sym->value;
+		shared_value old_shared = sym->shared;
+		char *buf = (len < SMALL_VALUE_SIZE) ? sym->small : malloc(len + 1);
+		memcpy(buf, value, len + 1);
+		if (old_shared)
+			release_shared_value(old_shared);
+		else if (old != NULL && old != sym->small)
+			free(old);
+		sym->shared = NULL;
+		sym->value = buf;
+		sym->value_size = (buf == sym->small) ? SMALL_VALUE_SIZE : len + 1;
+	}
+	sym->flags = STRING_VALID;
 }
 
-static void set_entry_name(symbol_table st, int address, const char *name)
+/* short values are still copied inline, longer ones are shared */
+static void set_entry_shared(symbol_table_internal *symbol_table_p, int slot, shared_value value)
 {
-	symbol_table_internal *symbol_table_p = reveal(st);
-	/* we have to be careful in the situation where we are 
-	    adding a new name.  Don't free() the old, empty one.
-	 */
-	if (name == NULL) return; /* do not want null entries */	
-	if (address == symbol_table_p->table_size) return; /* just in case */
-	if (address == symbol_table_p->num_entries) 
+	var_symbol *sym;
+	if (value == NULL) return;
+	if (value->length < SMALL_VALUE_SIZE)
 	{
-		symbol_table_p->num_entries++;
-		symbol_table_p->sym[address].name = strdup(name);
-		symbol_table_p->sym[address].value = NULL;
+		set_entry_value(symbol_table_p, slot, value->text);
+		return;
 	}
-	else 
+	sym = change_slot(symbol_table_p, slot);
+	if (value != sym->shared)
 	{
-		char *old = symbol_table_p->sym[address].name;
-		symbol_table_p->sym[address].name = strdup(name);
-		free(old);
+		retain_shared_value(value);
+		release_value(sym);
 	}
+	sym->shared = value;
+	sym->value = value->text;
+	sym->value_size = 0;
+	sym->flags = STRING_VALID;
+}
+
+/* the string form is left out of date until it is needed */
+static void set_entry_integer(symbol_table_internal *symbol_table_p, int slot, int value)
+{
+	var_symbol *sym = change_slot(symbol_table_p, slot);
+	sym->int_value = value;
+	sym->flags = INTEGER_VALID | INTEGER_EXACT;
+}
+
+static var_symbol *ref_slot(symbol_table_internal *symbol_table_p, symbol_ref ref);
+
+/* find or add the named symbol so that its value can be changed. Finish the 
+   change with finish_update().
+ */
+static int slot_for_update(symbol_table_internal *symbol_table_p, const char *name)
+{
+	unsigned int hash = hash_name(name);
+	int slot = find_slot(symbol_table_p, name, hash);
+	if (slot == NO_SYMBOL) /* did not find the symbol */
+		slot = new_slot(symbol_table_p, name, hash);
+	if (SLOT(symbol_table_p, slot).position == NOT_LISTED)
+		list_slot(symbol_table_p, slot);
+	return slot;
+}
+
+/* as slot_for_update() for a symbol reference. Returns NULL if the reference is not valid */
+static var_symbol *ref_for_update(symbol_table_internal *symbol_table_p, symbol_ref ref)
+{
+	var_symbol *sym = ref_slot(symbol_table_p, ref);
+	if (!sym)
+		return NULL;
+	if (sym->position == NOT_LISTED)
+		list_slot(symbol_table_p, ref);
+	return &SLOT(symbol_table_p, ref);
+}
+
+static void finish_update(symbol_table_internal *symbol_table_p, int slot)
+{
+	change_slot(symbol_table_p, slot)->generation = next_generation(symbol_table_p);
+	if (SLOT(symbol_table_p, slot).watchers)
+		notify_watchers(symbol_table_p, slot);
+}
+
+/* lookups that report whether the symbol was found instead of setting found_key() */
+
+int lookup_integer_value(symbol_table st, const char *name, int *value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	int slot;
+	slot = defined_slot(symbol_table_p, name);
+	if (slot != NO_SYMBOL)
+		*value = integer_of(&SLOT(symbol_table_p, slot));
+	return slot != NO_SYMBOL;
+}
+
+int lookup_string_value(symbol_table st, const char *name, const char **value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	int slot;
+	slot = defined_slot(symbol_table_p, name);
+	if (slot != NO_SYMBOL)
+		*value = string_of(&SLOT(symbol_table_p, slot));
+	return slot != NO_SYMBOL;
+}
+
+int lookup_shared_value(symbol_table st, const char *name, shared_value *value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	int slot;
+	slot = defined_slot(symbol_table_p, name);
+	if (slot != NO_SYMBOL)
+		*value = share_entry_value(&SLOT(symbol_table_p, slot));
+	return slot != NO_SYMBOL;
 }
 
 /* attempt to access the given symbol as an integer.
@@ -299,11 +1384,9 @@ static void set_entry_name(symbol_table st, int address, const char *name)
 */
 int get_integer_value(symbol_table st, const char *name)
 {
-	symbol_table_internal *symbol_table_p = reveal(st);
-	int pos = find_symbol_address(st, name);
-	if (pos < symbol_table_p->num_entries)
-		return atoi(symbol_table_p->sym[pos].value);
-	return 0;
+	int value = 0;
+	note_found(reveal(st), lookup_integer_value(st, name, &value));
+	return value;
 }
 
 /* 
@@ -312,11 +1395,9 @@ int get_integer_value(symbol_table st, const char *name)
  */
 const char *get_string_value(symbol_table st, const char *name)
 {
-	symbol_table_internal *symbol_table_p = reveal(st);
-	int pos = find_symbol_address(st, name);
-	if (pos < symbol_table_p->num_entries)
-		return symbol_table_p->sym[pos].value;
-	return NULL;
+	const char *value = NULL;
+	note_found(reveal(st), lookup_string_value(st, name, &value));
+	return value;
 }
 
 /*
@@ -326,31 +1407,43 @@ const char *get_string_value(symbol_table st, const char *name)
 void set_string_value(symbol_table st, const char *name, const char *value)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int pos = find_symbol_address(st, name);
-	if (pos == symbol_table_p->num_entries) /* did not find the symbol */
-	{
-		if (pos == symbol_table_p->table_size) /* table is full */
-		{
-			long unit_size = sizeof(struct var_symbol);
-			/* grow the symbol table */
-			var_symbol *new_table;
-			int bytes_used = unit_size * symbol_table_p->table_size;
-			int new_bytes;
-			symbol_table_p->table_size += symbol_table_p->page_size;
-			new_bytes = unit_size * symbol_table_p->table_size;
-
-			new_table = malloc(new_bytes);
-			memset(new_table, 0, new_bytes);
-			if (bytes_used > 0)
-			{
-				memcpy(new_table, symbol_table_p->sym, bytes_used);
-				free(symbol_table_p->sym);
-			}
-			symbol_table_p->sym = new_table;
-		}
-		set_entry_name(st, pos, name);
-	}
-	set_entry_value(st, pos, value);
+	int slot;
+	if (!writable(symbol_table_p)) return;
+	slot = slot_for_update(symbol_table_p, name);
+	set_entry_value(symbol_table_p, slot, value);
+	finish_update(symbol_table_p, slot);
+}
+
+/* returns a reference to the value of the symbol, or NULL if it is not defined */
+shared_value get_shared_value(symbol_table st, const char *name)
+{
+	shared_value value = NULL;
+	note_found(reveal(st), lookup_shared_value(st, name, &value));
+	return value;
+}
+
+void set_shared_value(symbol_table st, const char *name, shared_value value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	int slot;
+	if (!writable(symbol_table_p)) return;
+	slot = slot_for_update(symbol_table_p, name);
+	set_entry_shared(symbol_table_p, slot, value);
+	finish_update(symbol_table_p, slot);
+}
+
+void set_string_values(symbol_table st, int count, const char *names[], const char *values[])
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	int i;
+	if (count <= 0 || !writable(symbol_table_p))
+		return;
+	reserve_slots(symbol_table_p, count);
+	reserve_order(symbol_table_p, count, NO_SYMBOL);
+	if ( (symbol_table_p->num_named + count) * 2 > symbol_table_p->index_size)
+		resize_index(symbol_table_p, symbol_table_p->num_named + count);
+	for (i=0; i<count; i++)
+		set_string_value(st, names[i], values[i]);
 }
 
 /*
@@ -359,49 +1452,416 @@ void set_string_value(symbol_table st, const char *name, const char *value)
  */
 void set_integer_value(symbol_table st, const char *name, int value)
 {
-	char *tmp = malloc(20); /* should be large enough for most values */
-	sprintf(tmp, "%d", value);
-	set_string_value(st, name, tmp);
-	free(tmp);
+	symbol_table_internal *symbol_table_p = reveal(st);
+	int slot;
+	if (!writable(symbol_table_p)) return;
+	slot = slot_for_update(symbol_table_p, name);
+	set_entry_integer(symbol_table_p, slot, value);
+	finish_update(symbol_table_p, slot);
 }
 
 /* search the symbol table for items matching given values */
 const char *find_symbol_with_int_value(symbol_table st, int search)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
+	int order_length;
 	int i;
-    char *result = NULL;
-	char *tmp = malloc(20); /* should be large enough for most values */
+    const char *result = NULL;
+	char tmp[INTEGER_STRING_SIZE];
 	sprintf(tmp, "%d", search);
-	symbol_table_p->found_key = 0;
-	for (i=0; i<num_entries; i++)
+	order_length = symbol_table_p->order_length;
+	for (i=0; i<order_length; i++)
 	{
-		const char *value = symbol_table_p->sym[i].value;
-		if (strcmp(value, tmp) == 0)
+		var_symbol *sym = listed_symbol(symbol_table_p, i);
+		int matched;
+		if (!sym) continue;
+		if (sym->flags & INTEGER_EXACT)
+			matched = (sym->int_value == search);
+		else
+			matched = (sym->flags & STRING_VALID) && strcmp(sym->value, tmp) == 0;
+		if (matched)
 		{
-			symbol_table_p->found_key = 1;
-			result = symbol_table_p->sym[i].name;
+			result = sym->name;
             break;
 		}
 	}
-    free(tmp);
+	note_found(symbol_table_p, result != NULL);
 	return result;	
 }
 
 const char *find_symbol_with_string_value(symbol_table st, const char *search)
 {
 	symbol_table_internal *symbol_table_p = reveal(st);
-	int num_entries = symbol_table_p->num_entries;
+	int order_length;
+	int i;
+	const char *result = NULL;
+	order_length = symbol_table_p->order_length;
+	for (i=0; i<order_length; i++)
+	{
+		var_symbol *sym = listed_symbol(symbol_table_p, i);
+		const char *value = (sym) ? string_of(sym) : NULL;
+		if (value && strcmp(value, search) == 0)
+		{
+			result = sym->name;
+			break;
+		}
+	}
+	note_found(symbol_table_p, result != NULL);
+	return result;
+}
+
+/* snapshots */
+
+/* share the pages and lists of a table with a snapshot or private copy. 
+   Preparing the pages changes the way values are held, but not the values.
+ */
+static void share_contents(symbol_table_internal *copy_p, symbol_table_internal *symbol_table_p)
+{
+	int i;
+	sort_names(symbol_table_p);
+	copy_p->pages_size = (symbol_table_p->num_pages > 0) ? symbol_table_p->num_pages : 1;
+	copy_p->pages = malloc(copy_p->pages_size * sizeof(symbol_page *));
+	for (i=0; i<symbol_table_p->num_pages; i++)
+	{
+		prepare_page(symbol_table_p->pages[i]);
+		__sync_add_and_fetch(&symbol_table_p->pages[i]->refs, 1);
+		copy_p->pages[i] = symbol_table_p->pages[i];
+	}
+	copy_p->num_pages = symbol_table_p->num_pages;
+	copy_p->table_size = symbol_table_p->table_size;
+	copy_p->num_slots = symbol_table_p->num_slots;
+	copy_p->num_named = symbol_table_p->num_named;
+	copy_p->num_entries = symbol_table_p->num_entries;
+	copy_p->num_removed = symbol_table_p->num_removed;
+	copy_p->generation = symbol_table_p->generation;
+	if (!symbol_table_p->sharers)
+	{
+		symbol_table_p->sharers = malloc(sizeof(share_count));
+		symbol_table_p->sharers->refs = 1;
+	}
+	__sync_add_and_fetch(&symbol_table_p->sharers->refs, 1);
+	copy_p->shared_from = symbol_table_p->sharers;
+
+	/* the lists and the index hold slot numbers, which are unchanged */
+	retain_list(symbol_table_p->order);
+	copy_p->order = symbol_table_p->order;
+	copy_p->order_length = symbol_table_p->order_length;
+	copy_p->order_size = symbol_table_p->order_size;
+	retain_list(symbol_table_p->sorted);
+	copy_p->sorted = symbol_table_p->sorted;
+	copy_p->num_sorted = symbol_table_p->num_sorted;
+	copy_p->sorted_size = symbol_table_p->sorted_size;
+	retain_list(symbol_table_p->index);
+	copy_p->index = symbol_table_p->index;
+	copy_p->index_size = symbol_table_p->index_size;
+}
+
+symbol_table snapshot_symbol_table(symbol_table st)
+{
+	symbol_table result = init_symbol_table();
+	symbol_table_internal *snapshot_p = reveal(result);
+	share_contents(snapshot_p, reveal(st));
+	snapshot_p->read_only = 1;
+	return result;
+}
+
+/* private copies */
+
+symbol_table copy_symbol_table(symbol_table st)
+{
+	symbol_table result = init_symbol_table();
+	symbol_table_internal *copy_p = reveal(result);
+	copy_p->private_copy = 1;
+	share_contents(copy_p, reveal(st));
+	copy_p->copied_generation = copy_p->generation;
+	return result;
+}
+
+void refresh_copy(symbol_table copy, symbol_table st)
+{
+	symbol_table_internal *copy_p = reveal(copy);
+	if (!copy_p->private_copy)
+		return;
+	release_contents(copy_p);
+	copy_p->num_unsorted = 0;
+	copy_p->free_slot = NO_SYMBOL;
+	copy_p->watch_pending = 0;
+	copy_p->found_key = 0;
+	share_contents(copy_p, reveal(st));
+	copy_p->copied_generation = copy_p->generation;
+	copy_p->binding++;
+}
+
+void merge_copy(symbol_table st, symbol_table copy)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	symbol_table_internal *copy_p = reveal(copy);
 	int i;
-	for (i=0; i<num_entries; i++)
+	for (i=0; i<copy_p->num_slots; i++)
+	{
+		int page = i / SLOTS_PER_PAGE;
+		var_symbol *sym;
+		if (i % SLOTS_PER_PAGE == 0 && page < symbol_table_p->num_pages 
+				&& copy_p->pages[page] == symbol_table_p->pages[page])
+		{
+			i += SLOTS_PER_PAGE - 1; /* still shared, so the copy changed nothing on it */
+			continue;
+		}
+		sym = &SLOT(copy_p, i);
+		if (sym->name == NULL || sym->generation <= copy_p->copied_generation)
+			continue;
+		if (sym->position == NOT_LISTED)
+			remove_symbol(st, sym->name);
+		else
+		{
+			shared_value value = share_entry_value(sym);
+			set_shared_value(st, sym->name, value);
+			release_shared_value(value);
+		}
+	}
+}
+
+unsigned int binding_generation(symbol_table st)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	return symbol_table_p->binding;
+}
+
+/* symbol references */
+
+static var_symbol *ref_slot(symbol_table_internal *symbol_table_p, symbol_ref ref)
+{
+	/* symbols bound after a snapshot was taken are simply not in it */
+	if (symbol_table_p->read_only && ref >= symbol_table_p->num_slots)
+		return NULL;
+	if (ref < 0 || ref >= symbol_table_p->num_slots || SLOT(symbol_table_p, ref).name == NULL)
+	{
+		fprintf(stderr, "error: invalid symbol reference %d\n", ref);
+		return NULL;
+	}
+	return &SLOT(symbol_table_p, ref);
+}
+
+symbol_ref bind_symbol(symbol_table st, const char *name)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	unsigned int hash = hash_name(name);
+	int slot;
+	slot = find_slot(symbol_table_p, name, hash);
+	if (!symbol_table_p->read_only) /* a snapshot is never compacted so slots need not be marked */
+	{
+		if (slot == NO_SYMBOL)
+			slot = new_slot(symbol_table_p, name, hash);
+		if (!SLOT(symbol_table_p, slot).bound)
+			change_slot(symbol_table_p, slot)->bound = 1;
+	}
+	return slot;
+}
+
+const char *ref_name(symbol_table st, symbol_ref ref)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym = ref_slot(symbol_table_p, ref);
+	return (sym) ? sym->name : NULL;
+}
+
+int ref_is_defined(symbol_table st, symbol_ref ref)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym = ref_slot(symbol_table_p, ref);
+	return sym && sym->position != NOT_LISTED;
+}
+
+int lookup_ref_string_value(symbol_table st, symbol_ref ref, const char **value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym;
+	int found;
+	sym = ref_slot(symbol_table_p, ref);
+	found = (sym && sym->position != NOT_LISTED);
+	if (found)
+		*value = string_of(sym);
+	return found;
+}
+
+int lookup_ref_integer_value(symbol_table st, symbol_ref ref, int *value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym;
+	int found;
+	sym = ref_slot(symbol_table_p, ref);
+	found = (sym && sym->position != NOT_LISTED);
+	if (found)
+		*value = integer_of(sym);
+	return found;
+}
+
+int lookup_ref_shared_value(symbol_table st, symbol_ref ref, shared_value *value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym;
+	int found;
+	sym = ref_slot(symbol_table_p, ref);
+	found = (sym && sym->position != NOT_LISTED);
+	if (found)
+		*value = share_entry_value(sym);
+	return found;
+}
+
+unsigned int ref_generation(symbol_table st, symbol_ref ref)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym = ref_slot(symbol_table_p, ref);
+	return (sym) ? sym->generation : 0;
+}
+
+const char *get_ref_string_value(symbol_table st, symbol_ref ref)
+{
+	const char *value = NULL;
+	note_found(reveal(st), lookup_ref_string_value(st, ref, &value));
+	return value;
+}
+
+int get_ref_integer_value(symbol_table st, symbol_ref ref)
+{
+	int value = 0;
+	note_found(reveal(st), lookup_ref_integer_value(st, ref, &value));
+	return value;
+}
+
+const char *ref_name_lookup(symbol_table st, symbol_ref ref)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym;
+	const char *result = NULL;
+	sym = ref_slot(symbol_table_p, ref);
+	if (sym)
+	{
+		if (sym->position != NOT_LISTED)
+			result = string_of(sym);
+		if (!result)
+			result = sym->name;
+	}
+	return result;
+}
+
+void set_ref_string_value(symbol_table st, symbol_ref ref, const char *value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	if (!writable(symbol_table_p) || !ref_for_update(symbol_table_p, ref)) return;
+	set_entry_value(symbol_table_p, ref, value);
+	finish_update(symbol_table_p, ref);
+}
+
+shared_value get_ref_shared_value(symbol_table st, symbol_ref ref)
+{
+	shared_value value = NULL;
+	note_found(reveal(st), lookup_ref_shared_value(st, ref, &value));
+	return value;
+}
+
+void set_ref_shared_value(symbol_table st, symbol_ref ref, shared_value value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	if (!writable(symbol_table_p) || !ref_for_update(symbol_table_p, ref)) return;
+	set_entry_shared(symbol_table_p, ref, value);
+	finish_update(symbol_table_p, ref);
+}
+
+int copy_ref_value(symbol_table st, symbol_ref to, symbol_ref from)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	shared_value value = NULL;
+	const char *text = NULL;
+	char buf[SMALL_VALUE_SIZE];
+	int int_value = 0;
+	int exact = 0;
+	var_symbol *src;
+	if (!writable(symbol_table_p))
+		return 0;
+	src = ref_slot(symbol_table_p, from);
+	if (src && src->position != NOT_LISTED)
+	{
+		exact = src->flags & INTEGER_EXACT;
+		int_value = src->int_value;
+		if (!exact)
+			text = peek_entry_value(src, buf, &value);
+	}
+	else
+		src = NULL;
+	if (!src || to == from || !ref_for_update(symbol_table_p, to))
+	{
+		release_shared_value(value);
+		return src != NULL;
+	}
+	if (exact)
+		set_entry_integer(symbol_table_p, to, int_value);
+	else if (value)
+		set_entry_shared(symbol_table_p, to, value);
+	else if (text)
+		set_entry_value(symbol_table_p, to, text);
+	finish_update(symbol_table_p, to);
+	release_shared_value(value);
+	return 1;
+}
+
+const char *read_ref_value(symbol_table st, symbol_ref ref, char *buf, shared_value *value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym;
+	const char *text = NULL;
+	*value = NULL;
+	sym = ref_slot(symbol_table_p, ref);
+	if (sym && sym->position != NOT_LISTED)
+		text = peek_entry_value(sym, buf, value);
+	return text;
+}
+
+void set_ref_integer_value(symbol_table st, symbol_ref ref, int value)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	if (!writable(symbol_table_p) || !ref_for_update(symbol_table_p, ref)) return;
+	set_entry_integer(symbol_table_p, ref, value);
+	finish_update(symbol_table_p, ref);
+}
+
+void watch_symbol(symbol_table st, symbol_ref ref, symbol_watcher *f, void *user_data)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym;
+	symbol_watch *w;
+	if (!writable(symbol_table_p) || symbol_table_p->private_copy) return;
+	w = malloc(sizeof(symbol_watch));
+	w->func = f;
+	w->user_data = user_data;
+	sym = ref_slot(symbol_table_p, ref);
+	if (sym)
+	{
+		sym = change_slot(symbol_table_p, ref);
+		w->next = sym->watchers;
+		sym->watchers = w;
+	}
+	else
+		free(w);
+}
+
+void unwatch_symbol(symbol_table st, symbol_ref ref, symbol_watcher *f, void *user_data)
+{
+	symbol_table_internal *symbol_table_p = reveal(st);
+	var_symbol *sym;
+	sym = ref_slot(symbol_table_p, ref);
+	if (sym)
 	{
-		const char *value = symbol_table_p->sym[i].value;
-		if (strcmp(value, search) == 0)
+		symbol_watch **prev;
+		sym = change_slot(symbol_table_p, ref);
+		prev = &sym->watchers;
+		while (*prev && ((*prev)->func != f || (*prev)->user_data != user_data))
+			prev = &(*prev)->next;
+		if (*prev)
 		{
-			symbol_table_p->found_key = 1;
-			return symbol_table_p->sym[i].name;
+			symbol_watch *w = *prev;
+			*prev = w->next;
+			free(w);
 		}
 	}
-	return NULL;
 }
@@ -27,6 +27,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /* a simple symbol table */
 typedef struct symbol_table { long unused; } *symbol_table;
 
+/* an immutable string that symbols can share, see new_shared_value() */
+typedef struct shared_value_internal *shared_value;
+
 /* initialisation of the class */
 symbol_table init_symbol_table();
 
@@ -36,6 +39,40 @@ void dump_symbol_table(symbol_table st);
 /* release all memory used by the symbol table */
 void free_symbol_table(symbol_table st);
 
+/* 
+   return a read only copy of the symbol table as it is now. The snapshot 
+   shares its storage with the original, which copies a page of symbols or a 
+   list when it next changes it, so taking a snapshot costs little more than 
+   a pass over the pages changed since the last one. Symbol references bound 
+   on the original table can be used to read the snapshot; the original does 
+   not reuse the slots of removed symbols while it has snapshots. Snapshots are 
+   released with free_symbol_table() and may be read by several threads and 
+   released by another thread while the original continues to change. 
+   Reading a snapshot never changes it, so found_key() is not set by lookups 
+   on a snapshot; use the lookup_ functions.
+ */
+symbol_table snapshot_symbol_table(symbol_table st);
+
+/* 
+   return a private copy of the symbol table, sharing its storage in the 
+   same way as a snapshot. The copy may be changed, and may be used on 
+   another thread while the original continues to change, but it has no 
+   watchers. refresh_copy() makes the copy match the table again and 
+   merge_copy() sets in the table each symbol that was changed or removed 
+   in the copy since it was made or refreshed. References bound on the table 
+   read the same symbols in the copy, but names first added to one of them 
+   have different references in each, so bind those on the copy. Release it 
+   with free_symbol_table().
+ */
+symbol_table copy_symbol_table(symbol_table st);
+void refresh_copy(symbol_table copy, symbol_table st);
+void merge_copy(symbol_table st, symbol_table copy);
+
+/* symbol references bound on a table remain valid while this is unchanged. 
+   It only changes when a private copy is refreshed.
+ */
+unsigned int binding_generation(symbol_table st);
+
 /* returns the value of the symbol if the name is found, otherways the symbol name */
 const char *name_lookup(symbol_table st, const char *name);
 
@@ -44,6 +81,12 @@ typedef void (symbol_func)(const char *name, const char *value, void *user_data)
 
 void each_symbol(symbol_table st, symbol_func f, void *user_data);
 
+/* visit, in the order they were added, only the symbols whose names begin with the prefix */
+void each_symbol_with_prefix(symbol_table st, const char *prefix, symbol_func f, void *user_data);
+
+/* remove all the symbols whose names begin with the prefix */
+void remove_symbols_with_prefix(symbol_table st, const char *prefix);
+
 void remove_symbol(symbol_table st, const char *name);
 
 /* remove all the symbols with a name matching the pattern */
@@ -54,10 +97,21 @@ symbol_table collect_matching(symbol_table st, const char *pattern);
 
 
 /*
-   query whether the last lookup on a symbol table successfully found a key
+   query whether the last lookup on a symbol table successfully found a key. 
+   Lookups on a snapshot do not set this.
  */
 int found_key(symbol_table st);
 
+/* 
+   reentrant lookups. These return nonzero and store the value if the symbol 
+   is defined, otherwise they return zero and leave the value unchanged, so 
+   the caller can supply a default. They do not change found_key().
+ */
+int lookup_integer_value(symbol_table st, const char *name, int *value);
+int lookup_string_value(symbol_table st, const char *name, const char **value);
+/* the caller receives a new reference to the value */
+int lookup_shared_value(symbol_table st, const char *name, shared_value *value);
+
 /* attempt to access the given symbol as an integer.
    if the symbol is not known or is not a number, zero is returned.
 */
@@ -87,6 +141,13 @@ const char *get_string_value_beginning(symbol_table st, const char *prefix);
  */
 void set_string_value(symbol_table st, const char *name, const char *value);
 
+/*
+   update or add a number of string symbols at once. Space for all the new 
+   symbols is allocated in one step, and the new names are sorted and merged 
+   into the name order together, the next time a prefix is looked up.
+ */
+void set_string_values(symbol_table st, int count, const char *names[], const char *values[]);
+
 /*
    update the given string symbol with a new value from an integer
    if the symbol is not known, it is added to the symbol table
@@ -94,8 +155,91 @@ void set_string_value(symbol_table st, const char *name, const char *value);
 void set_integer_value(symbol_table st, const char *name, int value);
 
 
+/*
+   a shared value is an immutable, reference counted string. Symbols holding 
+   a shared value refer to it rather than keeping a copy, so passing large 
+   values (eg plugin results) between variables does not copy them. 
+   Short values are always copied into the symbol.
+ */
+
+/* both return a value with one reference. adopt_shared_value takes 
+   ownership of a malloced string. */
+shared_value new_shared_value(const char *text);
+shared_value adopt_shared_value(char *text);
+
+shared_value retain_shared_value(shared_value v);
+void release_shared_value(shared_value v);
+const char *shared_value_text(shared_value v);
+int shared_value_length(shared_value v);
+
+/* returns a new reference to the value of the symbol, or NULL if the symbol is not known */
+shared_value get_shared_value(symbol_table st, const char *name);
+
+/* the symbol takes its own reference to the value */
+void set_shared_value(symbol_table st, const char *name, shared_value value);
+
 /* search the symbol table for items matching given values */
 const char *find_symbol_with_int_value(symbol_table st, int value);
 const char *find_symbol_with_string_value(symbol_table st, const char *value);
 
+/* 
+   symbol references are stable handles on a named slot in the symbol table.
+   Binding a name that is not yet defined reserves a slot for it; the symbol 
+   remains undefined (found_key() is false) until a value is set. A reference
+   remains valid while the symbol table exists, even if the symbol is removed.
+ */
+typedef int symbol_ref;
+#define NO_SYMBOL -1
+
+symbol_ref bind_symbol(symbol_table st, const char *name);
+
+/* the name of the referenced symbol */
+const char *ref_name(symbol_table st, symbol_ref ref);
+
+/* nonzero if the referenced symbol currently has a value */
+int ref_is_defined(symbol_table st, symbol_ref ref);
+
+/* the generation changes whenever the symbol is set or removed, so a caller 
+   can tell whether a value it used before may have changed. Zero if the
+   reference is not valid.
+ */
+unsigned int ref_generation(symbol_table st, symbol_ref ref);
+
+const char *get_ref_string_value(symbol_table st, symbol_ref ref);
+int get_ref_integer_value(symbol_table st, symbol_ref ref);
+
+/* reentrant versions, as lookup_string_value() etc */
+int lookup_ref_string_value(symbol_table st, symbol_ref ref, const char **value);
+int lookup_ref_integer_value(symbol_table st, symbol_ref ref, int *value);
+int lookup_ref_shared_value(symbol_table st, symbol_ref ref, shared_value *value);
+
+/* returns the value of the symbol if it is defined, otherwise the symbol name */
+const char *ref_name_lookup(symbol_table st, symbol_ref ref);
+
+void set_ref_string_value(symbol_table st, symbol_ref ref, const char *value);
+void set_ref_integer_value(symbol_table st, symbol_ref ref, int value);
+
+shared_value get_ref_shared_value(symbol_table st, symbol_ref ref);
+void set_ref_shared_value(symbol_table st, symbol_ref ref, shared_value value);
+
+/* give one symbol the value of another, sharing rather than copying it.
+   Returns zero if the symbol copied from has no value.
+ */
+int copy_ref_value(symbol_table st, symbol_ref to, symbol_ref from);
+
+/* as lookup_ref_shared_value() without allocating. A value shorter than 
+   SYMBOL_BUFFER_SIZE is copied into buf, a longer one is shared and *value 
+   must be released. Returns the text or NULL if the symbol has no value.
+ */
+#define SYMBOL_BUFFER_SIZE 24
+const char *read_ref_value(symbol_table st, symbol_ref ref, char *buf, shared_value *value);
+
+/* a watcher is called after the value of a symbol is set or the symbol is 
+   removed. It may use the table.
+ */
+typedef void (symbol_watcher)(symbol_table st, symbol_ref ref, void *user_data);
+
+void watch_symbol(symbol_table st, symbol_ref ref, symbol_watcher *f, void *user_data);
+void unwatch_symbol(symbol_table st, symbol_ref ref, symbol_watcher *f, void *user_data);
+
 #endif
@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include "y.tab.h"
+#include "symboltable.h"
+#include "condition.h"
+#include "state_registry.h"
+#include "buffers.h"
+
+/* conditions that are the same in several states are made once, and shared */
+
+static int failures = 0;
+
+symbol_table states;
+
+/* the parameters the parser gives a condition, one for each word */
+static parameter_list words(const char *first, const char *second)
+{
+	parameter_list result = init_parameter_list(4);
+	add_parameter(result, first);
+	if (second)
+		add_parameter(result, second);
+	return result;
+}
+
+static void check_defined(symbol_table variables, const char *name, int expected)
+{
+	if ((get_string_value(variables, name) != NULL) != expected)
+	{
+		printf("%s is %s\n", name, (expected) ? "not defined" : "defined");
+		failures++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	symbol_table variables = init_symbol_table();
+	int start_set, unknown_set, running_set, stopped_set, idle_set;
+
+	states = init_symbol_table();
+	init_conditions();
+	init_state_registry();
+	start_set = create_condition_set();
+	unknown_set = create_condition_set();
+	running_set = create_condition_set();
+	stopped_set = create_condition_set();
+	idle_set = create_condition_set();
+	set_integer_value(states, "START", start_set);
+	set_integer_value(states, "UNKNOWN", unknown_set);
+	register_state(start_set, "START");
+	register_state(unknown_set, "UNKNOWN");
+	register_state(running_set, "RUNNING");
+	register_state(stopped_set, "STOPPED");
+	register_state(idle_set, "IDLE");
+
+	set_string_value(variables, "MODE", "running");
+
+	/* COLLECT LOAD FROM CALL LOADAVG in two states, then from another plugin. 
+	   There are no plugins here, so these states are ruled out. */
+	add_condition(stopped_set, "LOAD", ASSIGNED, "CALL LOADAVG", words("CALL", "LOADAVG"));
+	add_condition(idle_set, "LOAD", ASSIGNED, "CALL LOADAVG", words("CALL", "LOADAVG"));
+	add_condition(idle_set, "LOAD", ASSIGNED, "CALL UPTIME", words("CALL", "UPTIME"));
+	/* COLLECT COPY FROM MODE in two states */
+	add_condition(running_set, "COPY", ASSIGNED, "MODE", words("MODE", NULL));
+	add_condition(stopped_set, "COPY", ASSIGNED, "MODE", words("MODE", NULL));
+	/* the same test in two states */
+	add_condition(running_set, "MODE", EQ, "running", NULL);
+	add_condition(idle_set, "MODE", EQ, "running", NULL);
+	add_condition(stopped_set, "COPY", EQ, "stopped", NULL);
+	bind_all_conditions(variables);
+
+	if (check_all_conditions(variables) != running_set)
+	{
+		printf("the conditions did not select RUNNING\n");
+		failures++;
+	}
+	check_defined(variables, "COPY", 1);
+	/* conditions are numbered as they are added and shared ones are not numbered 
+	   again, so the test of MODE is the fourth. The test of COPY is only needed 
+	   in STOPPED. */
+	check_defined(variables, "STAT_CONDITION_3_RUNS", 1);
+	check_defined(variables, "STAT_CONDITION_4_RUNS", 0);
+
+	release_all_conditions();
+	release_state_registry();
+	free_symbol_table(variables);
+	free_symbol_table(states);
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("conditions ok\n");
+	return failures != 0;
+}
@@ -0,0 +1,152 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "y.tab.h"
+#include "symboltable.h"
+#include "condition.h"
+#include "state_registry.h"
+#include "method.h"
+#include "variable_store.h"
+#include "monitor_cycle.h"
+
+/* a monitor cycle where nothing changes state should not allocate memory.
+
+   This runs the monitor's cycle on a small configuration without plugins, 
+   with a persistent variable and DEBUG set, and counts the calls to the 
+   allocator. Counting replaces the glibc allocator entry points, elsewhere 
+   the test only runs the cycles and passes.
+ */
+
+#define WARMUP_CYCLES 20
+#define COUNTED_CYCLES 10
+
+static int counting;
+static int allocations;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCATIONS
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size)
+{
+	if (counting) allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	if (counting) allocations++;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	if (counting) allocations++;
+	return __libc_realloc(p, size);
+}
+#endif
+
+symbol_table states;
+
+int main(int argc, char *argv[])
+{
+	const char *filename = (argc > 1) ? argv[1] : "/tmp/test_idle_cycle.dat";
+	symbol_table variables = init_symbol_table();
+	monitor_cycle cycle;
+	int start_set, unknown_set, running_set, stopped_set;
+	int poll_method;
+	int i;
+
+	states = init_symbol_table();
+	init_conditions();
+	init_state_registry();
+	start_set = create_condition_set();
+	unknown_set = create_condition_set();
+	running_set = create_condition_set();
+	stopped_set = create_condition_set();
+	set_integer_value(states, "START", start_set);
+	set_integer_value(states, "UNKNOWN", unknown_set);
+	register_state(start_set, "START");
+	register_state(unknown_set, "UNKNOWN");
+	register_state(running_set, "RUNNING");
+	register_state(stopped_set, "STOPPED");
+
+	set_string_value(variables, "MODE", "running");
+	set_integer_value(variables, "LEVEL", 3);
+	set_string_value(variables, "BANNER", "host1.example.com service is running ok");
+	set_string_value(variables, "DEBUG", "false");
+	add_condition(running_set, "COPY", ASSIGNED, "MODE", NULL);
+	add_condition(running_set, "LEVEL", GE, "2", NULL);
+	add_condition(running_set, "MODE", EQ, "running", NULL);
+	add_condition(running_set, "BANNER", MATCHES, "running ok", NULL);
+	add_condition(running_set, "TIMER", GE, "0", NULL);
+	add_condition(stopped_set, "MODE", EQ, "stopped", NULL);
+	add_condition(stopped_set, "TIME", GT, "LEVEL", NULL);
+	bind_all_conditions(variables);
+
+	init_methods(variables);
+	poll_method = create_method();
+	add_assign_action(poll_method, "COUNT", "1");
+	add_assign_action(poll_method, "LAST_MODE", "MODE");
+	set_integer_value(variables, "POLL_RUNNING", poll_method);
+	bind_all_methods();
+	bind_state_methods(variables);
+
+	unlink(filename);
+	if (open_variable_store(filename) == 0)
+		persist_variable(variables, "LAST_MODE");
+	else
+		perror(filename);
+
+	init_monitor_cycle(&cycle, variables, start_set);
+	for (i=0; i<WARMUP_CYCLES + COUNTED_CYCLES; i++)
+	{
+		counting = (i >= WARMUP_CYCLES);
+		run_monitor_cycle(&cycle);
+	}
+	counting = 0;
+	if (cycle.active != find_state(running_set) || cycle.active->polls != WARMUP_CYCLES + COUNTED_CYCLES - 1)
+	{
+		printf("the cycles did not settle in RUNNING\n");
+		return 1;
+	}
+#ifdef COUNT_ALLOCATIONS
+	printf("allocations in %d idle cycles: %d\n", COUNTED_CYCLES, allocations);
+#else
+	printf("allocations are not counted on this platform\n");
+#endif
+
+	close_variable_store();
+	unlink(filename);
+	release_all_methods();
+	release_all_conditions();
+	release_state_registry();
+	free_symbol_table(variables);
+	free_symbol_table(states);
+	return (allocations == 0) ? 0 : 1;
+}
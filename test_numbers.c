@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "numbers.h"
+
+static int failures = 0;
+
+static void check_integer(const char *string, int expected_result, int expected_value)
+{
+	int value = 0;
+	int result = parse_integer(string, &value);
+	if (result != expected_result || (result && value != expected_value))
+	{
+		printf("parse_integer(\"%s\") returned %d, value %d\n", string, result, value);
+		failures++;
+	}
+}
+
+static void check_boolean(const char *string, int default_value, int expected)
+{
+	int result = parse_boolean(string, default_value);
+	if (result != expected)
+	{
+		printf("parse_boolean(\"%s\", %d) returned %d\n", string ? string : "(null)", default_value, result);
+		failures++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	check_integer("0", 1, 0);
+	check_integer("42", 1, 42);
+	check_integer("-42", 1, -42);
+	check_integer("007", 1, 7);
+	check_integer("-007", 1, -7);
+	check_integer("-0", 1, 0);
+	check_integer("2147483647", 1, 2147483647);
+	check_integer("-2147483648", 1, -2147483647 - 1);
+
+	/* not integers */
+	check_integer("", 0, 0);
+	check_integer("-", 0, 0);
+	check_integer("--1", 0, 0);
+	check_integer("+1", 0, 0);
+	check_integer(" 1", 0, 0);
+	check_integer("1 ", 0, 0);
+	check_integer("12a", 0, 0);
+	check_integer("0x10", 0, 0);
+	check_integer("1.5", 0, 0);
+	if (parse_integer(NULL, NULL) != 0)
+	{
+		printf("parse_integer(NULL) is an integer\n");
+		failures++;
+	}
+	if (parse_integer("12", NULL) != 1)
+	{
+		printf("parse_integer without a value failed\n");
+		failures++;
+	}
+
+	/* values that overflow are still integers and wrap like atoi() */
+	check_integer("2147483648", 1, atoi("2147483648"));
+	check_integer("-2147483649", 1, atoi("-2147483649"));
+	check_integer("4294967296", 1, atoi("4294967296"));
+	check_integer("99999999999", 1, atoi("99999999999"));
+
+	check_boolean("YES", 0, 1);
+	check_boolean("TRUE", 0, 1);
+	check_boolean("NO", 1, 0);
+	check_boolean("FALSE", 1, 0);
+	check_boolean("1", 0, 1);
+	check_boolean("-3", 0, 1);
+	check_boolean("0", 1, 0);
+	check_boolean("007", 0, 1);
+	check_boolean("000", 1, 0);
+	/* anything else gives the default */
+	check_boolean("yes", 0, 0);
+	check_boolean("true", 1, 1);
+	check_boolean("Y", 0, 0);
+	check_boolean("", 1, 1);
+	check_boolean("-", 0, 0);
+	check_boolean("YES ", 0, 0);
+	check_boolean(NULL, 1, 1);
+	check_boolean(NULL, 0, 0);
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("numbers ok\n");
+	return failures != 0;
+}
@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "symboltable.h"
+
+/* measures the cost of looking up symbols as the symbol table grows. 
+
+   usage: test_symbol_lookup [lookups]
+
+   the time per lookup should stay roughly flat from 10 to 100000 symbols.
+   The names are built before the clock starts so that only the table is 
+   measured. Each pass looks up a working set of at most WORKING_SET symbols,
+   the way a monitor cycle reads the same few hundred names over and over; 
+   the last column touches every symbol in turn, which for large tables 
+   measures cache misses rather than the index. The load column fills a fresh
+   table in batches of LOAD_BATCH names, in no particular order, the way 
+   properties are loaded, and then asks for a prefix; it should also stay flat.
+*/
+
+#define WORKING_SET 1000
+#define LOAD_BATCH 10
+
+static void count_symbol(const char *name, const char *value, void *user_data)
+{
+	(*(long *)user_data)++;
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char *argv[])
+{
+	int sizes[] = { 10, 100, 1000, 10000, 100000, 0 };
+	long lookups = 1000000;
+	int *size;
+	char name[40];
+	char **names;
+	int max_size = 100000;
+	long i;
+
+	if (argc > 1)
+		lookups = atol(argv[1]);
+
+	names = malloc(max_size * sizeof(char *));
+	for (i=0; i<max_size; i++)
+	{
+		sprintf(name, "RESULT_%ld", i);
+		names[i] = strdup(name);
+	}
+
+	printf("%10s %12s %12s %12s %12s\n", "symbols", "ns/lookup", "ns/update", "ns/scattered", "ns/load");
+	for (size = sizes; *size; size++)
+	{
+		symbol_table st = init_symbol_table();
+		struct timespec start, end;
+		long found = 0;
+		long working = (*size < WORKING_SET) ? *size : WORKING_SET;
+		long stride = *size / working;
+		double lookup_ns, update_ns, scattered_ns, load_ns;
+		const char *batch_names[LOAD_BATCH];
+		const char *batch_values[LOAD_BATCH];
+		long loaded = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i=0; i<*size; i++)
+		{
+			batch_names[i % LOAD_BATCH] = names[(i * 7919) % *size];
+			batch_values[i % LOAD_BATCH] = "0";
+			if (i % LOAD_BATCH == LOAD_BATCH - 1 || i == *size - 1)
+				set_string_values(st, i % LOAD_BATCH + 1, batch_names, batch_values);
+		}
+		each_symbol_with_prefix(st, "RESULT_", count_symbol, &loaded);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		load_ns = elapsed_ns(&start, &end) / *size;
+		if (loaded != *size)
+			printf("error: loaded %ld of %d symbols\n", loaded, *size);
+		for (i=0; i<*size; i++)
+			set_integer_value(st, names[i], i);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i=0; i<lookups; i++)
+			if (get_string_value(st, names[((i * 7919) % working) * stride]) != NULL)
+				found++;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		lookup_ns = elapsed_ns(&start, &end) / lookups;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i=0; i<lookups; i++)
+			set_string_value(st, names[((i * 7919) % working) * stride], "x");
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		update_ns = elapsed_ns(&start, &end) / lookups;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i=0; i<lookups; i++)
+			if (get_string_value(st, names[(i * 7919) % *size]) != NULL)
+				found++;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		scattered_ns = elapsed_ns(&start, &end) / lookups;
+
+		if (found != 2 * lookups)
+			printf("error: only found %ld of %ld symbols\n", found, 2 * lookups);
+		printf("%10d %12.1f %12.1f %12.1f %12.1f\n", *size, lookup_ns, update_ns, scattered_ns, load_ns);
+		free_symbol_table(st);
+	}
+	for (i=0; i<max_size; i++)
+		free(names[i]);
+	free(names);
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "symboltable.h"
+#include "property.h"
+#include "variable_store.h"
+
+#define VALUE_SIZE 1000000
+
+/* keep saving one of two values, each of a single repeated character, until killed */
+static void save_forever(const char *filename)
+{
+	symbol_table st = init_symbol_table();
+	static char value[VALUE_SIZE];
+	int i;
+	open_variable_store(filename);
+	persist_variable(st, "alternating");
+	for (i=0; ; i++)
+	{
+		memset(value, (i % 2) ? 'a' : 'b', VALUE_SIZE - 1);
+		value[VALUE_SIZE - 1] = 0;
+		set_string_value(st, "alternating", value);
+		save_variables(st);
+	}
+}
+
+/* the value saved by a run that was killed must be one of the values it saved, not a mixture */
+static int check_killed_run(const char *filename)
+{
+	symbol_table st;
+	const char *value;
+	pid_t pid;
+	int i;
+	unlink(filename);
+	pid = fork();
+	if (pid == 0)
+		save_forever(filename);
+	usleep(200000);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	st = init_symbol_table();
+	open_variable_store(filename);
+	persist_variable(st, "alternating");
+	restore_variables(st, NULL);
+	value = get_string_value(st, "alternating");
+	close_variable_store();
+	if (!value || strlen(value) != VALUE_SIZE - 1)
+	{
+		printf("the value saved by a killed run was lost\n");
+		free_symbol_table(st);
+		return 1;
+	}
+	for (i=1; i<VALUE_SIZE - 1; i++)
+		if (value[i] != value[0])
+		{
+			printf("the value saved by a killed run is torn at %d\n", i);
+			free_symbol_table(st);
+			return 1;
+		}
+	printf("killed run left a whole value\n");
+	free_symbol_table(st);
+	return 0;
+}
+
+/* simulate two runs of the monitor sharing a store file */
+int main(int argc, char *argv[])
+{
+	const char *filename = (argc > 1) ? argv[1] : "/tmp/test_variable_store.dat";
+	symbol_table st;
+	char long_value[200];
+	int failures = 0;
+	int restored;
+
+	unlink(filename);
+	memset(long_value, 'x', sizeof(long_value) - 1);
+	long_value[sizeof(long_value) - 1] = 0;
+
+	/* first run */
+	st = init_symbol_table();
+	if (open_variable_store(filename) == -1)
+	{
+		perror(filename);
+		return 1;
+	}
+	set_string_property(st, "PERSISTENT", "scheduled_tasks", "YES");
+	set_string_property(st, "PERSISTENT", "counter", "1");
+	set_string_property(st, "PERSISTENT", "ignored", "NO");
+	persist_property_group(st, "PERSISTENT");
+	set_string_value(st, "scheduled_tasks", "short");
+	set_integer_value(st, "counter", 1);
+	set_string_value(st, "ignored", "not kept");
+	save_variables(st);
+	set_string_value(st, "scheduled_tasks", long_value); /* outgrows its record */
+	set_integer_value(st, "counter", 42);
+	save_variables(st);
+	close_variable_store();
+	free_symbol_table(st);
+
+	/* second run, the values are restored over the initial ones */
+	st = init_symbol_table();
+	open_variable_store(filename);
+	set_string_property(st, "PERSISTENT", "scheduled_tasks", "YES");
+	set_string_property(st, "PERSISTENT", "counter", "YES");
+	persist_property_group(st, "PERSISTENT");
+	set_string_value(st, "scheduled_tasks", "");
+	restored = restore_variables(st, NULL);
+	printf("restored %d variables\n", restored);
+	if (restored != 2) failures++;
+	if (strcmp(get_string_value(st, "scheduled_tasks"), long_value) != 0)
+	{
+		printf("scheduled_tasks was not restored\n");
+		failures++;
+	}
+	printf("counter: %d\n", get_integer_value(st, "counter"));
+	if (get_integer_value(st, "counter") != 42) failures++;
+	if (get_string_value(st, "ignored") != NULL) failures++;
+	close_variable_store();
+	free_symbol_table(st);
+
+	failures += check_killed_run(filename);
+
+	unlink(filename);
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("variable store ok\n");
+	return failures != 0;
+}
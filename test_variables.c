@@ -22,8 +22,62 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "symboltable.h"
 
+#define NUM_THREADS 4
+#define NUM_UPDATES 10000
+#define NUM_SNAPSHOT_SYMBOLS 100
+
+static int snapshot_reads = 0;
+
+/* each thread reads every symbol of a snapshot and counts the values that are unchanged */
+static void *read_snapshot(void *user_data)
+{
+	symbol_table snapshot = (symbol_table)user_data;
+	int round, i;
+	for (round=0; round<NUM_UPDATES / NUM_SNAPSHOT_SYMBOLS; round++)
+		for (i=0; i<NUM_SNAPSHOT_SYMBOLS; i++)
+		{
+			char name[20];
+			int value = -1;
+			sprintf(name, "SNAP_%d", i);
+			if (lookup_integer_value(snapshot, name, &value) && value == i)
+				__sync_fetch_and_add(&snapshot_reads, 1);
+		}
+	return NULL;
+}
+
+/* a plugin call working on its own copy of the variables */
+static void *change_copy(void *user_data)
+{
+	symbol_table copy = (symbol_table)user_data;
+	char name[20];
+	int i;
+	set_string_value(copy, "RESULT_ARG", "a long value set in the copy by a plugin call");
+	set_string_value(copy, "WATCHED", "changed in the copy");
+	remove_symbol(copy, "REMOVED");
+	for (i=0; i<NUM_SNAPSHOT_SYMBOLS; i++)
+	{
+		sprintf(name, "COPY_%d", i);
+		set_integer_value(copy, name, i);
+	}
+	return NULL;
+}
+
+static void show_symbol(const char *name, const char *value, void *user_data)
+{
+	printf("%s: %s\n", name, value);
+}
+
+static void count_changes(symbol_table st, symbol_ref ref, void *user_data)
+{
+	const char *value = get_ref_string_value(st, ref);
+	(*(int *)user_data)++;
+	printf("watched %s is now %s\n", ref_name(st, ref), value ? value : "(removed)");
+}
+
 int main(int argc, char *argv[])
 {
 	symbol_table st = init_symbol_table();
@@ -50,6 +104,216 @@ int main(int argc, char *argv[])
 	printf("After removing symbol A:\n");
 	remove_symbol(st, "A");
 	dump_symbol_table(st);
-	free_symbol_table(st);	
+
+	{
+		symbol_ref b = bind_symbol(st, "B");
+		symbol_ref d = bind_symbol(st, "D");
+		printf("B by reference: %s, D is %sdefined\n", 
+			get_ref_string_value(st, b), ref_is_defined(st, d) ? "" : "not ");
+		set_ref_integer_value(st, d, get_ref_integer_value(st, b) * 2);
+		remove_symbol(st, "B");
+		set_ref_string_value(st, b, "again");
+		printf("After updating by reference:\n");
+		dump_symbol_table(st);
+	}
+
+	set_string_value(st, "GROUP_Z", "first");
+	set_string_value(st, "GROUPIE", "not in the group");
+	set_string_value(st, "GROUP_A", "second");
+	printf("Symbols in GROUP:\n");
+	each_symbol_with_prefix(st, "GROUP_", show_symbol, NULL);
+	remove_symbols_with_prefix(st, "GROUP_");
+	printf("After removing GROUP:\n");
+	dump_symbol_table(st);
+
+	{
+		/* repeatedly add and remove a batch of symbols; removed entries 
+			should be reclaimed rather than accumulating */
+		const char *names[] = { "BATCH_A", "BATCH_B", "BATCH_C" };
+		const char *values[] = { "1", "2", "3" };
+		int i;
+		for (i=0; i<100; i++)
+		{
+			set_string_values(st, 3, names, values);
+			remove_symbols_with_prefix(st, "BATCH_");
+		}
+		set_string_values(st, 3, names, values);
+		printf("After batch updates:\n");
+		dump_symbol_table(st);
+	}
+
+	/* values move between inline and allocated storage as their length changes */
+	set_string_value(st, "SIZE", "short");
+	set_string_value(st, "SIZE", "a value that is too long to be kept inline");
+	set_string_value(st, "SIZE", get_string_value(st, "SIZE") + 30);
+	printf("SIZE: %s\n", get_string_value(st, "SIZE"));
+	set_string_value(st, "SIZE", "ok");
+	printf("SIZE: %s\n", get_string_value(st, "SIZE"));
+
+	{
+		/* long values are shared between symbols rather than copied */
+		symbol_ref from = bind_symbol(st, "SHARED_FROM");
+		symbol_ref to = bind_symbol(st, "SHARED_TO");
+		shared_value v = adopt_shared_value(strdup("a plugin result that is long enough to share"));
+		set_ref_shared_value(st, from, v);
+		release_shared_value(v);
+		copy_ref_value(st, to, from);
+		printf("SHARED_TO: %s (%s)\n", get_ref_string_value(st, to), 
+			(get_ref_string_value(st, to) == get_ref_string_value(st, from)) ? "shared" : "copied");
+		set_ref_string_value(st, from, "changed");
+		printf("SHARED_FROM: %s, SHARED_TO: %s\n", get_ref_string_value(st, from), get_ref_string_value(st, to));
+	}
+
+	{
+		/* a snapshot keeps its values while the table changes */
+		symbol_ref to = bind_symbol(st, "SHARED_TO");
+		symbol_table snapshot = snapshot_symbol_table(st);
+		set_ref_string_value(st, to, "changed after the snapshot");
+		set_integer_value(st, "C", 0);
+		printf("snapshot SHARED_TO: %s, C: %d\n", get_ref_string_value(snapshot, to),
+			get_integer_value(snapshot, "C"));
+		printf("table SHARED_TO: %s, C: %d\n", get_ref_string_value(st, to),
+			get_integer_value(st, "C"));
+		free_symbol_table(snapshot);
+	}
+
+	{
+		/* watchers hear about changes and removal */
+		int changes = 0;
+		symbol_ref watched = bind_symbol(st, "WATCHED_LIBRARY");
+		watch_symbol(st, watched, count_changes, &changes);
+		set_string_value(st, "WATCHED_LIBRARY", "libone.so");
+		set_ref_integer_value(st, watched, 2);
+		set_string_value(st, "UNWATCHED", "x");
+		remove_symbols_with_prefix(st, "WATCHED_");
+		unwatch_symbol(st, watched, count_changes, &changes);
+		set_string_value(st, "WATCHED_LIBRARY", "libtwo.so");
+		printf("watched changes: %d\n", changes);
+	}
+
+	{
+		/* generations change when a symbol is set or removed, and only then */
+		symbol_ref counted = bind_symbol(st, "COUNTED");
+		unsigned int first, second, third;
+		set_integer_value(st, "COUNTED", 1);
+		first = ref_generation(st, counted);
+		set_string_value(st, "UNCOUNTED", "x");
+		second = ref_generation(st, counted);
+		remove_symbol(st, "COUNTED");
+		third = ref_generation(st, counted);
+		printf("generations: %s %s\n", (first == second) ? "kept" : "changed",
+				(second == third) ? "kept" : "changed");
+	}
+	free_symbol_table(st);
+
+	{
+		/* several threads read one snapshot while the table it was taken from 
+		   changes, and the snapshot outlives the table */
+		symbol_table table = init_symbol_table();
+		symbol_table snapshot;
+		pthread_t threads[NUM_THREADS];
+		char name[20];
+		int i;
+		for (i=0; i<NUM_SNAPSHOT_SYMBOLS; i++)
+		{
+			sprintf(name, "SNAP_%d", i);
+			set_integer_value(table, name, i);
+		}
+		snapshot = snapshot_symbol_table(table);
+		for (i=0; i<NUM_THREADS; i++)
+			pthread_create(&threads[i], NULL, read_snapshot, snapshot);
+		for (i=0; i<NUM_SNAPSHOT_SYMBOLS; i++)
+		{
+			sprintf(name, "SNAP_%d", i);
+			if (i % 2)
+				remove_symbol(table, name);
+			else
+				set_string_value(table, name, "a value long enough to be held in a buffer");
+			sprintf(name, "NEW_%d", i);
+			set_integer_value(table, name, i);
+		}
+		for (i=0; i<NUM_THREADS; i++)
+			pthread_join(threads[i], NULL);
+		free_symbol_table(table);
+		printf("snapshot reads: %d of %d\n", snapshot_reads, NUM_THREADS * NUM_UPDATES);
+		each_symbol_with_prefix(snapshot, "SNAP_9", show_symbol, NULL);
+		free_symbol_table(snapshot);
+	}
+
+	{
+		/* a private copy changes on another thread while its table changes, 
+		   then what changed in the copy is merged back */
+		symbol_table table = init_symbol_table();
+		symbol_table copy;
+		pthread_t thread;
+		symbol_ref watched = bind_symbol(table, "WATCHED");
+		int changes = 0;
+		char name[20];
+		int i;
+		watch_symbol(table, watched, count_changes, &changes);
+		set_string_value(table, "KEPT", "kept");
+		set_string_value(table, "REMOVED", "removed in the copy");
+		copy = copy_symbol_table(table);
+		pthread_create(&thread, NULL, change_copy, copy);
+		for (i=0; i<NUM_SNAPSHOT_SYMBOLS; i++)
+		{
+			sprintf(name, "TABLE_%d", i);
+			set_integer_value(table, name, i);
+		}
+		pthread_join(thread, NULL);
+		printf("before merging, RESULT_ARG %s, watched changes: %d\n", 
+			get_string_value(table, "RESULT_ARG") ? "is set" : "is not set", changes);
+		merge_copy(table, copy);
+		printf("merged RESULT_ARG: %s\n", get_string_value(table, "RESULT_ARG"));
+		printf("merged REMOVED: %s, KEPT: %s, COPY_99: %d, TABLE_99: %d\n", 
+			get_string_value(table, "REMOVED") ? "defined" : "removed", get_string_value(table, "KEPT"),
+			get_integer_value(table, "COPY_99"), get_integer_value(table, "TABLE_99"));
+		i = binding_generation(copy);
+		refresh_copy(copy, table);
+		printf("refreshed copy TABLE_99: %d, binding %s\n", get_integer_value(copy, "TABLE_99"),
+			(binding_generation(copy) != i) ? "changed" : "kept");
+		free_symbol_table(copy);
+		unwatch_symbol(table, watched, count_changes, &changes);
+		free_symbol_table(table);
+	}
+
+	{
+		/* the slots of removed symbols are not reused while a snapshot or copy 
+		   shares them, so references still read the right symbols there */
+		symbol_table table = init_symbol_table();
+		symbol_table snapshot, copy;
+		symbol_ref old_ref, new_ref;
+		char name[20];
+		int i;
+		for (i=0; i<NUM_SNAPSHOT_SYMBOLS; i++)
+		{
+			sprintf(name, "OLD_%d", i);
+			set_integer_value(table, name, i);
+		}
+		snapshot = snapshot_symbol_table(table);
+		copy = copy_symbol_table(table);
+		old_ref = bind_symbol(table, "OLD_5"); /* bound after the copy was made */
+		for (i=0; i<NUM_SNAPSHOT_SYMBOLS; i++)
+		{
+			sprintf(name, "OLD_%d", i);
+			remove_symbol(table, name);
+			remove_symbol(copy, name);
+		}
+		for (i=0; i<NUM_SNAPSHOT_SYMBOLS; i++)
+		{
+			sprintf(name, "NEW_%d", i);
+			set_integer_value(copy, name, -i);
+		}
+		new_ref = bind_symbol(table, "NEW");
+		set_ref_integer_value(table, new_ref, -1);
+		printf("snapshot through the new reference: %s, OLD_5: %d\n",
+			get_ref_string_value(snapshot, new_ref) ? "defined" : "not defined",
+			get_integer_value(snapshot, "OLD_5"));
+		printf("copy through the old reference: %s\n",
+			get_ref_string_value(copy, old_ref) ? get_ref_string_value(copy, old_ref) : "not defined");
+		free_symbol_table(snapshot);
+		free_symbol_table(copy);
+		free_symbol_table(table);
+	}
 	return 0;
 }
\ No newline at end of file
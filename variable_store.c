@@ -0,0 +1,438 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "variable_store.h"
+#include "symboltable.h"
+#include "property.h"
+#include "options.h"
+#include "numbers.h"
+
+/* The store file is a header followed by a sequence of records. A record
+   holds the name of a variable and two slots for its value. A new value is 
+   written into the slot that is not in use and then published by a single 
+   store of the record's current word, so a monitor killed part way through 
+   leaves the previous value intact. Values that fit are written this way, 
+   otherwise a larger record holding the value is appended and the old one 
+   is marked dead. Dead records are squeezed out when the store is opened.
+ */
+
+#define STORE_MAGIC "MONSTOR1"
+#define STORE_VERSION 2
+#define STORE_INITIAL_SIZE 4096
+#define STORE_UNSET 0xffffffffU /* current word of a variable with no value */
+#define STORE_ALIGN(n) (((n) + 7) & ~7U)
+
+struct store_header
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int used; /* bytes in use, including this header */
+	unsigned int records;
+	unsigned int reserved;
+};
+
+struct store_record
+{
+	unsigned int name_len; /* excluding the terminator */
+	unsigned int capacity; /* room for a value in each slot, including the terminator */
+	unsigned int current; /* STORE_UNSET or the length of the value * 2 + the slot holding it */
+	unsigned int live;
+	/* the name and its terminator follow, then the two value slots */
+};
+
+struct persistent_variable
+{
+	symbol_ref ref;
+	unsigned int offset; /* of the variable's record, zero if there is none */
+};
+
+static int store_fd = -1;
+static char *store_map = NULL;
+static size_t store_size = 0;
+static struct persistent_variable *persistent = NULL;
+static int num_persistent = 0;
+static int persistent_capacity = 0;
+
+static struct store_header *header()
+{
+	return (struct store_header *)store_map;
+}
+
+static struct store_record *record_at(unsigned int offset)
+{
+	return (struct store_record *)(store_map + offset);
+}
+
+static unsigned int record_size(unsigned int name_len, unsigned int capacity)
+{
+	return sizeof(struct store_record) + STORE_ALIGN(name_len + 1) + 2 * STORE_ALIGN(capacity);
+}
+
+static char *record_name(struct store_record *r)
+{
+	return (char *)(r + 1);
+}
+
+static char *value_slot(struct store_record *r, unsigned int slot)
+{
+	return record_name(r) + STORE_ALIGN(r->name_len + 1) + slot * STORE_ALIGN(r->capacity);
+}
+
+static char *record_value(struct store_record *r)
+{
+	return value_slot(r, r->current & 1);
+}
+
+static unsigned int value_length(struct store_record *r)
+{
+	return r->current >> 1;
+}
+
+/* write the value into the slot that is not in use, then switch to it */
+static void write_value(struct store_record *r, const char *value, unsigned int len)
+{
+	unsigned int slot = (r->current == STORE_UNSET) ? 0 : !(r->current & 1);
+	char *buf = value_slot(r, slot);
+	memcpy(buf, value, len);
+	buf[len] = 0;
+	__sync_synchronize(); /* the value is complete before it is published */
+	r->current = (len << 1) | slot;
+}
+
+static int map_store(size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store_fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	store_map = p;
+	store_size = size;
+	return 0;
+}
+
+/* make sure there are at least 'needed' bytes after the used part of the file */
+static int reserve(unsigned int needed)
+{
+	size_t new_size = store_size;
+	if (header()->used + needed <= store_size)
+		return 0;
+	while (header()->used + needed > new_size)
+		new_size *= 2;
+	if (ftruncate(store_fd, new_size) == -1)
+		return -1;
+	munmap(store_map, store_size);
+	if (map_store(new_size) == -1)
+	{
+		store_map = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* walk the records, dropping any that are dead or damaged, and keeping only 
+   the most recent record for each name */
+static void compact()
+{
+	unsigned int offset = sizeof(struct store_header);
+	unsigned int end = header()->used;
+	unsigned int out = offset;
+	unsigned int count = 0;
+	while (offset + sizeof(struct store_record) <= end)
+	{
+		struct store_record *r = record_at(offset);
+		unsigned int size;
+		if (r->name_len == 0 || r->name_len > end || r->capacity == 0 || r->capacity > end
+				|| (r->current != STORE_UNSET && value_length(r) >= r->capacity))
+			break; /* the rest of the file cannot be trusted */
+		size = record_size(r->name_len, r->capacity);
+		if (size > end - offset || record_name(r)[r->name_len] != 0)
+			break;
+		if (r->live)
+		{
+			unsigned int later = offset + size;
+			while (later + sizeof(struct store_record) <= end)
+			{
+				struct store_record *l = record_at(later);
+				unsigned int lsize;
+				if (l->name_len > end || l->capacity > end)
+					break;
+				lsize = record_size(l->name_len, l->capacity);
+				if (lsize > end - later)
+					break;
+				if (l->live && strcmp(record_name(l), record_name(r)) == 0)
+				{
+					r->live = 0;
+					break;
+				}
+				later += lsize;
+			}
+		}
+		if (r->live)
+		{
+			if (out != offset)
+				memmove(store_map + out, r, size);
+			out += size;
+			count++;
+		}
+		offset += size;
+	}
+	header()->used = out;
+	header()->records = count;
+}
+
+int open_variable_store(const char *filename)
+{
+	struct stat st;
+	int fresh = 0;
+	if (store_fd != -1)
+		close_variable_store();
+	store_fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (store_fd == -1)
+		return -1;
+	if (fstat(store_fd, &st) == -1)
+		goto failed;
+	if (st.st_size < (off_t)sizeof(struct store_header))
+	{
+		if (ftruncate(store_fd, STORE_INITIAL_SIZE) == -1)
+			goto failed;
+		st.st_size = STORE_INITIAL_SIZE;
+		fresh = 1;
+	}
+	if (map_store(st.st_size) == -1)
+		goto failed;
+	if (!fresh && (memcmp(header()->magic, STORE_MAGIC, 8) != 0 
+			|| header()->version != STORE_VERSION 
+			|| header()->used < sizeof(struct store_header)
+			|| header()->used > store_size))
+	{
+		fprintf(stderr, "Warning: ignoring the contents of variable store %s\n", filename);
+		fresh = 1;
+	}
+	if (fresh)
+	{
+		memset(store_map, 0, sizeof(struct store_header));
+		memcpy(header()->magic, STORE_MAGIC, 8);
+		header()->version = STORE_VERSION;
+		header()->used = sizeof(struct store_header);
+	}
+	else
+		compact();
+	return 0;
+failed:
+	{
+		int err = errno;
+		close(store_fd);
+		store_fd = -1;
+		errno = err;
+	}
+	return -1;
+}
+
+void close_variable_store()
+{
+	if (store_map)
+	{
+		msync(store_map, store_size, MS_SYNC);
+		munmap(store_map, store_size);
+	}
+	if (store_fd != -1)
+		close(store_fd);
+	store_map = NULL;
+	store_size = 0;
+	store_fd = -1;
+	free(persistent);
+	persistent = NULL;
+	num_persistent = 0;
+	persistent_capacity = 0;
+}
+
+int variable_store_open()
+{
+	return store_map != NULL;
+}
+
+static unsigned int find_record(const char *name)
+{
+	unsigned int offset = sizeof(struct store_header);
+	while (offset < header()->used)
+	{
+		struct store_record *r = record_at(offset);
+		if (r->live && strcmp(record_name(r), name) == 0)
+			return offset;
+		offset += record_size(r->name_len, r->capacity);
+	}
+	return 0;
+}
+
+void persist_variable(symbol_table variables, const char *name)
+{
+	int i;
+	symbol_ref ref;
+	if (!store_map)
+		return;
+	ref = bind_symbol(variables, name);
+	for (i = 0; i < num_persistent; i++)
+		if (persistent[i].ref == ref)
+			return;
+	if (num_persistent == persistent_capacity)
+	{
+		int new_capacity = persistent_capacity ? persistent_capacity * 2 : 8;
+		struct persistent_variable *p = realloc(persistent, new_capacity * sizeof(struct persistent_variable));
+		if (!p)
+			return;
+		persistent = p;
+		persistent_capacity = new_capacity;
+	}
+	persistent[num_persistent].ref = ref;
+	persistent[num_persistent].offset = find_record(name);
+	num_persistent++;
+	if (verbose())
+		printf("variable %s will be kept in the store\n", name);
+}
+
+struct group_data
+{
+	symbol_table variables;
+};
+
+static void persist_if_true(const char *group, const char *name, const char *value, void *user_data)
+{
+	struct group_data *data = (struct group_data *)user_data;
+	if (parse_boolean(value, 0))
+		persist_variable(data->variables, name);
+}
+
+void persist_property_group(symbol_table variables, const char *property_group)
+{
+	struct group_data data;
+	data.variables = variables;
+	each_property(variables, property_group, persist_if_true, &data);
+}
+
+int restore_variables(symbol_table variables, void (*on_restore)(symbol_ref ref))
+{
+	int i;
+	int restored = 0;
+	if (!store_map)
+		return 0;
+	for (i = 0; i < num_persistent; i++)
+	{
+		struct store_record *r;
+		if (!persistent[i].offset)
+			continue;
+		r = record_at(persistent[i].offset);
+		if (r->current == STORE_UNSET)
+			continue;
+		set_ref_string_value(variables, persistent[i].ref, record_value(r));
+		if (on_restore)
+			on_restore(persistent[i].ref);
+		if (verbose())
+			printf("restored %s = %s\n", record_name(r), record_value(r));
+		restored++;
+	}
+	return restored;
+}
+
+/* append a new record holding the value of a variable, retiring the old one 
+   if there was one */
+static unsigned int append_record(const char *name, unsigned int old_offset, const char *value, unsigned int len)
+{
+	unsigned int capacity = len + 1;
+	unsigned int name_len = strlen(name);
+	unsigned int size;
+	unsigned int offset;
+	struct store_record *r;
+	if (old_offset && capacity < record_at(old_offset)->capacity * 2)
+		capacity = record_at(old_offset)->capacity * 2;
+	if (capacity < 16)
+		capacity = 16;
+	size = record_size(name_len, capacity);
+	if (reserve(size) == -1)
+		return 0;
+	offset = header()->used;
+	r = record_at(offset);
+	r->name_len = name_len;
+	r->capacity = capacity;
+	r->current = STORE_UNSET;
+	r->live = 1;
+	memcpy(record_name(r), name, name_len + 1);
+	write_value(r, value, len);
+	/* the new record is complete before it is counted and before the old 
+	   one is retired, so an interrupted update leaves one of them intact; 
+	   compact() keeps the later of two live records */
+	header()->used += size;
+	header()->records++;
+	if (old_offset)
+	{
+		record_at(old_offset)->live = 0;
+		header()->records--;
+	}
+	return offset;
+}
+
+void save_variables(symbol_table variables)
+{
+	int i;
+	if (!store_map)
+		return;
+	for (i = 0; i < num_persistent; i++)
+	{
+		struct persistent_variable *pv = &persistent[i];
+		const char *value = get_ref_string_value(variables, pv->ref);
+		struct store_record *r = pv->offset ? record_at(pv->offset) : NULL;
+		unsigned int len;
+		if (!value)
+		{
+			if (r && r->current != STORE_UNSET)
+				r->current = STORE_UNSET;
+			continue;
+		}
+		len = strlen(value);
+		if (r && r->current != STORE_UNSET && value_length(r) == len 
+				&& memcmp(record_value(r), value, len) == 0)
+			continue;
+		if (r && len < r->capacity)
+			write_value(r, value, len);
+		else
+		{
+			unsigned int offset = append_record(ref_name(variables, pv->ref), pv->offset, value, len);
+			if (!offset)
+			{
+				fprintf(stderr, "Warning: variable store is full: %s\n", strerror(errno));
+				if (!store_map)
+					return;
+				continue;
+			}
+			pv->offset = offset;
+		}
+	}
+}
@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2009-2019, Martin Leadbeater
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef __VARIABLE_STORE_H__
+#define __VARIABLE_STORE_H__
+
+#include "symboltable.h"
+
+/* The variable store keeps the values of selected variables in a memory 
+   mapped file so that they are available as soon as the monitor is 
+   restarted, without waiting for them to be collected again.
+
+   Variables are selected by name, usually from a property group:
+
+   PROPERTY PERSISTENT { DEFINE scheduled_tasks = YES }
+
+   Values are written through to the mapping at the end of each cycle so 
+   they survive the monitor being stopped or killed, but the file is only 
+   synchronised to disk when the store is closed.
+ */
+
+/* open the store, creating the file if necessary. returns 0 on success
+   or -1 if the file could not be opened or mapped (errno is set). */
+int open_variable_store(const char *filename);
+
+void close_variable_store();
+
+/* returns nonzero if a store has been opened */
+int variable_store_open();
+
+/* add a variable to those kept in the store */
+void persist_variable(symbol_table variables, const char *name);
+
+/* add the variables named in a property group whose value is true */
+void persist_property_group(symbol_table variables, const char *property_group);
+
+/* copy the values saved by an earlier run into the symbol table, calling 
+   on_restore (if it is not NULL) for each variable restored. returns the 
+   number of variables restored. */
+int restore_variables(symbol_table variables, void (*on_restore)(symbol_ref ref));
+
+/* write any values that have changed since they were last saved */
+void save_variables(symbol_table variables);
+
+#endif